@@ -1,22 +1,56 @@
 #ifndef CTL_ALLOC_H
 #define CTL_ALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include "ctl/def.h"
 
+/**
+ * Determines how a \ref "TArena" behaves once its current block is exhausted.
+ */
+typedef enum {
+    TARENA_FIXED = 0, /**< A single block is used, allocations fail once it is exhausted */
+    TARENA_CHAINED,   /**< New blocks are allocated on overflow and chained to the previous ones */
+    TARENA_VIRTUAL,   /**< A contiguous address range is reserved up front and committed as the arena grows */
+} TArenaKind;
+
+/**
+ * Header placed at the start of every block owned by a chained \ref "TArena".
+ * The usable region of the block directly follows the header.
+ */
+typedef struct TArenaBlock {
+    struct TArenaBlock *prev; /**< The block that was in use before this one, or `NULL` */
+    size_t capacity;          /**< Size of the usable region in bytes */
+} TArenaBlock;
+
 /**
  * \ref "TArena" is a bump / linear allocator.
  * A fixed size buffer is preallocated and parts of it are given to allocation requests.
  * All allocated data is deallocated / invalidated at once.
  * Resizing of allocations is not possible.
+ *
+ * Chained arenas (see \ref "tarenaNewChained") grow by allocating additional blocks instead of failing.
+ * Each new block is at least twice as large as the previous one, and allocations of 64 KiB or more
+ * that would fill over half of the next block get a dedicated block of their own.
+ *
+ * Virtual arenas (see \ref "tarenaNewVirtual") reserve address space without backing it with memory,
+ * and commit it as `tail` advances. Their data never moves and growing them never copies.
  */
 typedef struct {
-    void *head;       /**< Start of the block */
-    void *tail;       /**< Position for the next allocation */
-    size_t capacity;  /**< Block size */
-    size_t alignment; /**< Alignment requirement, defaults to `8` if set to `0` */
-    TCleanup cleanup; /**< Optional custom deallocation function */
+    void *head;         /**< Start of the current block */
+    void *tail;         /**< Position for the next allocation */
+    size_t capacity;    /**< Size of the current block */
+    size_t alignment;   /**< Alignment requirement, defaults to `8` if set to `0` */
+    TCleanup cleanup;   /**< Optional custom deallocation function */
+    TArenaKind kind;    /**< Growth behaviour of the arena */
+    TArenaBlock *block; /**< Header of the current block, only used by chained arenas */
+    size_t prev_used;   /**< Bytes used in the blocks before the current one */
+    size_t high_water;  /**< Largest number of bytes that were in use at once, kept across resets */
+    size_t reserved;    /**< Size of the reserved address range, only used by virtual arenas */
+    size_t commit_size; /**< Granularity at which memory is committed, only used by virtual arenas */
 } TArena;
 
 /**
@@ -26,6 +60,25 @@ typedef struct {
  */
 TArena tarenaNew(size_t cap);
 
+/**
+ * Allocates a new chained arena using `malloc`.
+ * The arena allocates more blocks when it runs out of space, so allocations only fail if `malloc` does.
+ * \param cap  Capacity of the first block in bytes
+ * \returns    A chained arena, or a zeroed arena if the first block could not be allocated
+ */
+TArena tarenaNewChained(size_t cap);
+
+/**
+ * Reserves `reserve` bytes of address space for a new virtual arena using `mmap`.
+ * Memory is committed in steps of `64 KiB` (or `2 MiB` with `huge_pages`) as allocations need it,
+ * `this->capacity` holds the committed size and allocations fail once `reserve` bytes are committed.
+ * Only available on POSIX systems.
+ * \param reserve    Size of the address range to reserve in bytes, rounded up to the commit granularity
+ * \param huge_pages Whether to align the range to `2 MiB` and ask the kernel to back it with transparent huge pages
+ * \returns          A virtual arena, or a zeroed arena if the address range could not be reserved
+ */
+TArena tarenaNewVirtual(size_t reserve, bool huge_pages);
+
 /**
  * Uses (owns) a preallocated buffer as an arena.
  * \param head    Start of the buffer
@@ -39,6 +92,11 @@ TArena tarenaNewFromBuffer(void *head, size_t cap, TCleanup cleanup);
  * Resets `this->tail`.
  * Allows reuse of the arena without allocation overhead.
  * This operation invalidates all previous pointers as new allocations will overwrite the existing data.
+ *
+ * Chained arenas only keep their largest block and deallocate the others,
+ * so an arena that is reset after every use stops allocating once it has grown large enough.
+ * Virtual arenas return all committed memory past the first commit step to the system with `madvise`,
+ * it stays committed and is faulted back in on reuse.
  * \param this
  */
 void tarenaReset(TArena *this);
@@ -48,9 +106,18 @@ void tarenaReset(TArena *this);
  * \param this
  * \param n_bytes Size of the allocation in bytes
  * \returns       A pointer to the allocated region, or `NULL` if the allocation would exceed the arena's capacity
+ *                (for chained arenas, `NULL` is only returned if a new block could not be allocated)
  */
 void *tarenaAlloc(TArena *this, size_t n_bytes);
 
+/**
+ * Returns the number of bytes currently in use in `this`, including alignment padding.
+ * The largest value this has ever reached is kept in `this->high_water`, which can be used to size arenas.
+ * \param this
+ * \returns    The number of bytes allocated since the arena was created or last reset
+ */
+size_t tarenaUsed(const TArena *this);
+
 /**
  * Moves ownership of `this` to a new arena and puts `this` into an empty state.
  * `this` can safely be passed to \ref "tarenaFree" after calling this function.
@@ -60,14 +127,144 @@ void *tarenaAlloc(TArena *this, size_t n_bytes);
 TArena tarenaMove(TArena *this);
 
 /**
- * Deallocates all data that is owned by `this` using `this->cleanup`
+ * Deallocates all data that is owned by `this` using `this->cleanup`.
+ * All blocks of a chained arena are deallocated with libc `free`, and virtual arenas are unmapped.
  * \param this
  */
 void tarenaFree(TArena *this);
 
+/**
+ * \ref "TArenaMark" captures the state of a \ref "TArena" so that it can be rolled back later.
+ * Everything allocated after the mark was taken is released by \ref "tarenaRewind",
+ * while allocations made before it stay valid.
+ */
+typedef struct {
+    TArena *arena;      /**< The arena the mark belongs to */
+    void *tail;         /**< Value of `arena->tail` when the mark was taken */
+    TArenaBlock *block; /**< Value of `arena->block` when the mark was taken */
+    TArenaBlock *prev;  /**< Value of `arena->block->prev` when the mark was taken */
+    size_t prev_used;   /**< Value of `arena->prev_used` when the mark was taken */
+} TArenaMark;
+
+/**
+ * Number of scratch arenas available to each thread.
+ */
+#define TARENA_SCRATCH_COUNT 2
+
+/**
+ * Capacity of the first block of each scratch arena.
+ */
+#define TARENA_SCRATCH_CAPACITY (64 * 1024)
+
+/**
+ * Captures the current state of `this`.
+ * \param this
+ * \returns    A mark which can be passed to \ref "tarenaRewind"
+ */
+TArenaMark tarenaMark(TArena *this);
+
+/**
+ * Deallocates everything that was allocated from `mark.arena` after `mark` was taken.
+ * Marks must be rewound in the reverse order they were taken, and a mark is invalidated by
+ * rewinding to an older mark or by calling \ref "tarenaReset" on the arena.
+ * Rewinding only moves `tail` unless new blocks were added to a chained arena since the mark was taken,
+ * in which case those blocks are deallocated.
+ * \param mark
+ */
+void tarenaRewind(TArenaMark mark);
+
+/**
+ * Borrows one of the calling thread's scratch arenas for temporary allocations.
+ * Scratch arenas are chained arenas which are created on first use.
+ * The arenas listed in `conflicts` are never returned, which allows functions that receive
+ * a scratch arena from their caller as an output arena to get a separate one for their temporaries:
+ * \code{c}
+ * TStringView joinPaths(TArena *out, TStringView a, TStringView b) {
+ *     TArenaMark scratch = tarenaScratchBegin(&out, 1);
+ *
+ *     // Temporaries are allocated from `scratch.arena`, the result from `out`
+ *
+ *     tarenaScratchEnd(scratch);
+ *     return result;
+ * }
+ * \endcode
+ * \param conflicts   Arenas which must not be returned, may be `NULL` if `n_conflicts` is `0`
+ * \param n_conflicts Length of `conflicts`
+ * \returns           A mark to the borrowed arena, whose `arena` field is `NULL` if no arena could be provided
+ */
+TArenaMark tarenaScratchBegin(TArena *const *conflicts, size_t n_conflicts);
+
+/**
+ * Returns a scratch arena borrowed with \ref "tarenaScratchBegin", releasing all allocations made since.
+ * This is equivalent to \ref "tarenaRewind".
+ * \param scratch
+ */
+void tarenaScratchEnd(TArenaMark scratch);
+
+/**
+ * Deallocates the calling thread's scratch arenas.
+ * Should be called before a thread which used \ref "tarenaScratchBegin" exits.
+ */
+void tarenaScratchFree(void);
+
+/**
+ * \ref "TConcurrentArena" is a bump allocator which can be shared by many threads.
+ * Threads reserve sub-blocks of `chunk_size` bytes with an atomic compare-and-swap on `offset`
+ * and serve small allocations from them without any synchronisation.
+ * The last sub-block may be shorter, and `offset` never exceeds `capacity`.
+ * Allocations larger than a quarter of a sub-block take their space from `offset` directly.
+ * Like \ref "TArena", all allocated data is deallocated / invalidated at once.
+ */
+typedef struct {
+    void *head;          /**< Start of the buffer */
+    size_t capacity;     /**< Size of the buffer */
+    size_t offset;       /**< Start of the unreserved part of the buffer, at most `capacity`, updated atomically */
+    size_t alignment;    /**< Alignment of every allocation, defaults to `8` if set to `0` */
+    size_t chunk_size;   /**< Size of the sub-blocks reserved by each thread */
+    uint64_t generation; /**< Identifies the current contents, changed by \ref "tcarenaReset" to invalidate sub-blocks */
+} TConcurrentArena;
+
+/**
+ * Allocates a new concurrent arena using `malloc`.
+ * \param cap Capacity of the arena in bytes
+ * \returns   The created arena, or a zeroed arena if the buffer could not be allocated
+ */
+TConcurrentArena tcarenaNew(size_t cap);
+
+/**
+ * Allocates `n_bytes` bytes from `this`, may be called by any number of threads at once.
+ * The remainder of a thread's sub-block is abandoned when it allocates from another arena,
+ * so threads should avoid interleaving allocations from many concurrent arenas.
+ * \param this
+ * \param n_bytes Size of the allocation in bytes
+ * \returns       A pointer to the allocated region, or `NULL` if the arena is exhausted
+ */
+void *tcarenaAlloc(TConcurrentArena *this, size_t n_bytes);
+
+/**
+ * Returns the number of bytes reserved in `this`, including the unused parts of sub-blocks.
+ * \param this
+ */
+size_t tcarenaUsed(const TConcurrentArena *this);
+
+/**
+ * Invalidates all allocations at once, making the whole buffer available again.
+ * Must not be called while other threads are allocating from `this`.
+ * \param this
+ */
+void tcarenaReset(TConcurrentArena *this);
+
+/**
+ * Deallocates the buffer owned by `this` and leaves it in an empty state.
+ * Must not be called while other threads are allocating from `this`.
+ * \param this
+ */
+void tcarenaFree(TConcurrentArena *this);
+
 typedef void *(*TAlloc)(size_t n_bytes, void *userdata);              /**< Allocates a new region of size `n_bytes` */
 typedef void *(*TRealloc)(void *old, size_t n_bytes, void *userdata); /**< Resizes an allocated region to be `n_bytes` */
 typedef void  (*TDealloc)(void *ptr, void *userdata);                 /**< Deallocates an allocated region */
+typedef size_t (*TAllocSize)(const void *ptr, void *userdata);        /**< Returns the size of an allocated region */
 
 /**
  * \ref "TDynamicAllocator" is a type whhich groups different kinds allocation functions.
@@ -78,6 +275,7 @@ typedef struct {
     TDealloc dealloc; /**< `free` equivelent of \ref "TDynamicAllocator" */
     TCleanup cleanup; /**< Optional custom cleanup function */
     void *userdata;   /**< Pointer passed to the cleanup function */
+    TAllocSize size;  /**< Optional, used by \ref "tdaResize" when `resize` is `NULL` */
 } TDynamicAllocator;
 
 /**
@@ -86,6 +284,21 @@ typedef struct {
  */
 TDynamicAllocator tdaLibc(void);
 
+/**
+ * Creates a \ref "TDynamicAllocator" which allocates from `arena`.
+ * Every allocation is prefixed with its size, which allows the following:
+ *   - Resizing the most recent allocation extends or shrinks it in place while it fits in the current block,
+ *     so buffers that are grown repeatedly are not copied on every resize.
+ *   - Deallocating the most recent allocation gives its space back to the arena,
+ *     deallocating any other allocation is a no-op.
+ *
+ * Other allocations are resized by copying them to a new allocation.
+ * The arena is not owned by the allocator and must outlive it.
+ * \param arena
+ * \returns     The created allocator
+ */
+TDynamicAllocator tdaArena(TArena *arena);
+
 /**
  * Cleans up the allocator (not to be confused with \ref "tdaDealloc").
  * \param this
@@ -104,20 +317,23 @@ void *tdaAlloc(TDynamicAllocator *this, size_t bytes);
  * Resizes a previously allocated region.
  * This invalidates `old`, even if the region is not moved much like `realloc`.
  *
- * If `this->resize` is `NULL`, this function will naively resize the buffer manually.
+ * If `this->resize` is `NULL`, this function will naively resize the buffer manually,
+ * which requires `this->size` to know how many bytes to copy.
  * In this case, \ref "tdaResize" is equivalent to the following:
  * \code{c}
+ * size_t old_bytes = this->size(old, this->userdata);
  * void *new_block = tdaAlloc(this, n_bytes);
- * memcpy(new_block, old, n_bytes);
+ * memcpy(new_block, old, old_bytes < n_bytes ? old_bytes : n_bytes);
  *
  * tdaDealloc(this, old);
  *
  * return new_block;
  * \endcode
  * \param this
- * \param old     The region to resize
+ * \param old     The region to resize, `NULL` is equivalent to calling \ref "tdaAlloc"
  * \param n_bytes New size
- * \returns       The new region if moved, `old` if not
+ * \returns       The new region if moved, `old` if not, or `NULL` if the region could not be resized
+ *                (`old` stays valid in that case)
  */
 void *tdaResize(TDynamicAllocator *this, void *old, size_t n_bytes);
 
@@ -128,4 +344,213 @@ void *tdaResize(TDynamicAllocator *this, void *old, size_t n_bytes);
  */
 void tdaDealloc(TDynamicAllocator *this, void *ptr);
 
+/**
+ * Header placed at the start of every slab owned by a \ref "TPool".
+ * The objects of the slab directly follow the header.
+ */
+typedef struct TPoolSlab {
+    struct TPoolSlab *next; /**< The slab used after this one, or `NULL` */
+    size_t n_objects;       /**< Number of objects the slab can hold */
+} TPoolSlab;
+
+/**
+ * \ref "TPool" is a pool allocator for objects of a single size.
+ * Objects are carved out of large slabs, and deallocated objects are kept in an intrusive free list
+ * so that allocation and deallocation are both a couple of pointer operations.
+ * Slabs are only returned to the system by \ref "tpoolFree".
+ * Objects are aligned to `8` bytes.
+ */
+typedef struct {
+    size_t object_size;  /**< Size of each object, rounded up to hold at least a pointer */
+    size_t slab_objects; /**< Number of objects in each newly allocated slab */
+    void *free_list;     /**< Most recently deallocated object, which points to the next one */
+    void *cursor;        /**< Next object in the current slab that has never been handed out */
+    void *end;           /**< End of the current slab */
+    TPoolSlab *slabs;    /**< The first slab */
+    TPoolSlab *slab;     /**< The slab objects are currently carved from */
+} TPool;
+
+/**
+ * Creates an empty pool, no memory is allocated until the first object is requested.
+ * \param object_size  Size of each object in bytes
+ * \param slab_objects Number of objects to allocate at once when the pool runs out, `0` picks a default
+ * \returns            The created pool
+ */
+TPool tpoolNew(size_t object_size, size_t slab_objects);
+
+/**
+ * Preallocates slabs so that at least `n` more objects can be handed out without allocating.
+ * Objects in the free list are not taken into account.
+ * \param this
+ * \param n    Number of objects to reserve
+ * \returns    `false` if a slab could not be allocated
+ */
+bool tpoolReserve(TPool *this, size_t n);
+
+/**
+ * Allocates a single object.
+ * \param this
+ * \returns    A pointer to an uninitialised object of `this->object_size` bytes, or `NULL` if a slab could not be allocated
+ */
+void *tpoolAlloc(TPool *this);
+
+/**
+ * Returns an object to the pool, `ptr` may be `NULL`.
+ * \param this
+ * \param ptr  An object allocated by `this`
+ */
+void tpoolDealloc(TPool *this, void *ptr);
+
+/**
+ * Invalidates all objects handed out by the pool at once, while keeping the slabs for reuse.
+ * \param this
+ */
+void tpoolReset(TPool *this);
+
+/**
+ * Deallocates all slabs owned by `this` and leaves it in an empty state.
+ * \param this
+ */
+void tpoolFree(TPool *this);
+
+/**
+ * Creates a \ref "TDynamicAllocator" which allocates from `pool`.
+ * Requests larger than `pool->object_size` fail, and resizing only succeeds if the new size fits in a single object.
+ * The pool is not owned by the allocator and must outlive it.
+ * \param pool
+ * \returns    The created allocator
+ */
+TDynamicAllocator tdaPool(TPool *pool);
+
+/**
+ * Largest request served from size classes by the slab allocator (see \ref "tslabAlloc").
+ * Larger requests are passed to `malloc` with a small header in front.
+ */
+#define TSLAB_MAX_SIZE 16384
+
+/**
+ * Allocates `n_bytes` bytes from the slab allocator.
+ *
+ * The slab allocator is a general purpose, thread-safe allocator for small objects.
+ * Requests are rounded up to one of 36 size classes (four per power of two, from `16` up to \ref "TSLAB_MAX_SIZE")
+ * and objects of each class are carved out of `64 KiB` slabs.
+ * Every thread caches freed objects in per-class magazines, so most allocations and deallocations
+ * never touch shared state. Full and empty magazines are exchanged with a central depot,
+ * which is also how objects freed by one thread are reused by others.
+ * Memory used by size classes is never returned to the system.
+ *
+ * Objects are aligned to `16` bytes.
+ * \param n_bytes Size of the allocation in bytes
+ * \returns       A pointer to the allocated region, or `NULL` on failure
+ */
+void *tslabAlloc(size_t n_bytes);
+
+/**
+ * Resizes an allocation made by \ref "tslabAlloc", with the semantics of `realloc`.
+ * The allocation is not moved if `n_bytes` belongs to the same size class.
+ * \param old     The region to resize, may be `NULL`
+ * \param n_bytes New size
+ * \returns       The new region if moved, `old` if not, or `NULL` on failure (`old` stays valid in that case)
+ */
+void *tslabResize(void *old, size_t n_bytes);
+
+/**
+ * Deallocates an allocation made by \ref "tslabAlloc" from any thread, `ptr` may be `NULL`.
+ * \param ptr
+ */
+void tslabDealloc(void *ptr);
+
+/**
+ * Returns the usable size of an allocation made by \ref "tslabAlloc".
+ * \param ptr
+ * \returns   The size of the size class of `ptr`, or the requested size for large allocations
+ */
+size_t tslabSize(const void *ptr);
+
+/**
+ * Moves every object cached by the calling thread to the central depot so that other threads can use them.
+ * Should be called before a thread which used the slab allocator exits, its cached objects are lost otherwise.
+ */
+void tslabFlushThread(void);
+
+/**
+ * Creates a \ref "TDynamicAllocator" that uses the slab allocator (see \ref "tslabAlloc").
+ * \returns The created allocator
+ */
+TDynamicAllocator tdaSlab(void);
+
+/**
+ * Number of buckets in the size histogram of \ref "TAllocStats".
+ */
+#define TALLOC_STATS_BUCKETS 32
+
+/**
+ * Allocation statistics collected by \ref "TTrackingAllocator".
+ */
+typedef struct {
+    size_t n_allocs;                            /**< Number of successful allocations */
+    size_t n_deallocs;                          /**< Number of deallocations */
+    size_t n_resizes;                           /**< Number of successful resizes */
+    size_t n_growths;                           /**< Number of successful resizes which made the region larger */
+    size_t total_bytes;                         /**< Sum of the sizes of all allocations */
+    size_t live_bytes;                          /**< Bytes currently allocated */
+    size_t peak_bytes;                          /**< Largest value `live_bytes` has reached */
+    size_t histogram[TALLOC_STATS_BUCKETS];     /**< Allocations and resizes by size, bucket `i` counts sizes below `2^i`
+                                                     (and at least `2^(i - 1)`), the last bucket counts everything larger */
+} TAllocStats;
+
+/**
+ * \ref "TTrackingAllocator" wraps another \ref "TDynamicAllocator" and records statistics about its usage.
+ * Counters are updated with relaxed atomic operations, so the wrapper can be shared between threads
+ * and left enabled in production.
+ * Every allocation is prefixed with a `16` byte header holding its size.
+ */
+typedef struct {
+    TDynamicAllocator inner; /**< The allocator which serves the requests, owned by the wrapper */
+    TAllocStats stats;       /**< Statistics, use \ref "ttrackSnapshot" to read them while other threads allocate */
+} TTrackingAllocator;
+
+/**
+ * Creates a tracking allocator which takes ownership of `inner`.
+ * \param inner The allocator to serve requests with
+ * \returns     The created tracking allocator with all statistics set to `0`
+ */
+TTrackingAllocator ttrackNew(TDynamicAllocator inner);
+
+/**
+ * Creates a \ref "TDynamicAllocator" which allocates through `tracker`.
+ * `tracker` is not owned by the allocator and must outlive it.
+ * \param tracker
+ * \returns       The created allocator
+ */
+TDynamicAllocator tdaTracking(TTrackingAllocator *tracker);
+
+/**
+ * Reads the statistics of `this`.
+ * Each counter is read atomically, but the snapshot as a whole is not taken atomically.
+ * \param this
+ * \returns    A copy of `this->stats`
+ */
+TAllocStats ttrackSnapshot(const TTrackingAllocator *this);
+
+/**
+ * Clears all counters of `this` except `live_bytes`.
+ * `peak_bytes` is set to the current value of `live_bytes`.
+ * \param this
+ */
+void ttrackResetStats(TTrackingAllocator *this);
+
+/**
+ * Cleans up the underlying allocator with \ref "tdaFree".
+ * \param this
+ */
+void ttrackFree(TTrackingAllocator *this);
+
+/**
+ * Writes a human readable summary of `stats` to `file`.
+ * \param stats
+ * \param file
+ */
+void tstatsPrint(const TAllocStats *stats, FILE *file);
+
 #endif
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "ctl/alloc.h"
+
 /**
  * Convenience macro to be used when minimal customisation is needed.
  */
@@ -45,12 +47,20 @@ __VA_ARGS__ struct_t prefix ## Dup(const struct_t *this); \
 #define CTL_DEFINE_ARRAY_METHODS(T, prefix) \
 CTL_DEFINE_ARRAY_METHODS_EXT(prefix, T, prefix, NULL, NULL) \
 
+/**
+ * Equivalent to \ref "CTL_DEFINE_ARRAY_METHODS_ALLOC_EXT" with `allocator` set to `NULL`.
+ * Refer to the documentation for \ref "CTL_DEFINE_ARRAY_METHODS_ALLOC_EXT" for more information regarding this macro.
+ */
+#define CTL_DEFINE_ARRAY_METHODS_EXT(struct_t, T, prefix, destructor, duplicator, ...) \
+CTL_DEFINE_ARRAY_METHODS_ALLOC_EXT(struct_t, T, prefix, destructor, duplicator, NULL, __VA_ARGS__) \
+
 /**
  * \param struct_t   Type which will serve as the array container
  * \param T          Type which the array will store
  * \param prefix     A prefix to be prepended to all method functions (must be unique unless declared as static)
  * \param destructor A callable which will be invoked for every invalidated object, before invalidation
  * \param duplicator A callable which will be invoked for every object during `$Dup()`
+ * \param allocator  An expression of type `TDynamicAllocator *` used for all allocations, or `NULL` to use libc
  * \param ...        Extra and optional declarations specifiers (`static`, etc.). Same declarations must be passed to \ref "CTL_DECLARE_ARRAY_METHODS_EXT".
  *
  * Specifiers such as `static` may be used in `...` to annotate all functions defined (except private functions which are always statically linked).
@@ -68,13 +78,35 @@ CTL_DEFINE_ARRAY_METHODS_EXT(prefix, T, prefix, NULL, NULL) \
  * `destructor` and / or `duplicator` may be `NULL`. In such case they will not be called.
  * If `duplicator` is `NULL`, a shallow `memcpy` will take place instead.
  *
+ * `allocator` is evaluated every time memory is allocated or deallocated, with `this` (of type `struct_t *`) in scope.
+ * It can refer to a global allocator, or to a member of the container so that every array carries its own:
+ * \code{c}
+ * typedef struct {
+ *     size_t length, capacity;
+ *     Token *items;
+ *     TDynamicAllocator *allocator;
+ * } TokenArray;
+ *
+ * CTL_DECLARE_ARRAY_METHODS_EXT(TokenArray, Token, tokens,)
+ * CTL_DEFINE_ARRAY_METHODS_ALLOC_EXT(TokenArray, Token, tokens, NULL, NULL, this->allocator,)
+ *
+ * TokenArray arr = tokensNew();
+ * arr.allocator = &request_allocator; // Must be set before anything is allocated
+ * tokensReserve(&arr, 64);
+ * \endcode
+ * In that case `$NewWithCap()` and `$NewFilled()` must not be used: they allocate before the member can be set,
+ * so the buffer would come from libc while `$Free()` and `$Reserve()` later pass it to the allocator.
+ * Create the array with `$New()`, set the member, then call `$Reserve()` or `$Fill()` instead.
+ * Members other than `length`, `capacity` and `items` are kept by `$Free()` and `$Move()`, and copied by `$Dup()`.
+ * If `allocator` is `NULL`, libc `realloc` and `free` are called directly.
+ *
  * This macro defines the following functions:
  * \code{c}
  * struct_t $New(void);                             // Creates an empty array
  * struct_t $NewWithCap(size_t cap);                // Creates an empty array and allocates enough memory for `cap` elements
  * struct_t $NewFilled(size_t n, T value);          // Creates an array of length `n` with all elements set to `value`
  * void $Free(struct_t *this);                      // Calls `destructor` for each element, deallocates any owned memory and leaves `this` in a valid state
- * void $Reserve(struct_t *this, size_t n);         // Reserves enough memory ahead of time to hold at least `n` elements
+ * void $Reserve(struct_t *this, size_t n);         // Reserves enough memory ahead of time to hold at least `n` elements, calls `$Free()` on failure
  * void $Fill(struct_t *this, size_t n, T value);   // Resizes the array to be of length `n` and sets every element to `value`
  * T *$Append(struct_t *this, T value);             // Appends `value` to the array and returns a reference to it
  * void $Pop(struct_t *this);                       // Calls `destructor` for the last element and removes it from the array
@@ -84,12 +116,15 @@ CTL_DEFINE_ARRAY_METHODS_EXT(prefix, T, prefix, NULL, NULL) \
  * struct_t $Dup(struct_t *this);                   // Creates a new array and populates each element with `duplicator`
  * \endcode
  */
-#define CTL_DEFINE_ARRAY_METHODS_EXT(struct_t, T, prefix, destructor, duplicator, ...) \
-static void __ ## prefix ## gen_warnings(void) { \
+#define CTL_DEFINE_ARRAY_METHODS_ALLOC_EXT(struct_t, T, prefix, destructor, duplicator, allocator, ...) \
+static void __ ## prefix ## gen_warnings(struct_t *this) { \
     typedef void (*destructor_t)(T *this); \
     typedef T (*dup_t)(const T *this); \
     destructor_t _de = destructor; \
     dup_t _du = duplicator; \
+    TDynamicAllocator *_al = allocator; \
+    (void)this; \
+    (void)_al; \
 } \
 static void __ ## prefix ## grow(struct_t *this, size_t n) { \
     if (this->capacity >= n) { \
@@ -103,6 +138,11 @@ static void __ ## prefix ## grow(struct_t *this, size_t n) { \
     \
     prefix ## Reserve(this, this->capacity + 1); \
 } \
+static void __ ## prefix ## clear(struct_t *this) { \
+    this->length = 0; \
+    this->capacity = 0; \
+    this->items = NULL; \
+} \
 \
 __VA_ARGS__ struct_t prefix ## New(void) { \
     struct_t this = { \
@@ -132,9 +172,13 @@ __VA_ARGS__ void prefix ## Free(struct_t *this) { \
         } \
     } \
     \
-    free(this->items); \
+    if (allocator) { \
+        tdaDealloc((allocator), this->items); \
+    } else { \
+        free(this->items); \
+    } \
     \
-    *this = prefix ## New(); \
+    __ ## prefix ## clear(this); \
 } \
 \
 __VA_ARGS__ void prefix ## Reserve(struct_t *this, size_t n) { \
@@ -142,12 +186,21 @@ __VA_ARGS__ void prefix ## Reserve(struct_t *this, size_t n) { \
         return; \
     } \
     \
-    this->capacity = n; \
-    this->items = realloc(this->items, n * (sizeof *this->items)); \
-    if (!this->items) { \
-        this->length = 0; \
-        this->capacity = 0; \
+    T *items; \
+    if (allocator) { \
+        items = tdaResize((allocator), this->items, n * (sizeof *this->items)); \
+    } else { \
+        items = realloc(this->items, n * (sizeof *this->items)); \
     } \
+    \
+    /* The array is emptied on failure, its elements are destroyed along with the old buffer */ \
+    if (!items) { \
+        prefix ## Free(this); \
+        return; \
+    } \
+    \
+    this->items = items; \
+    this->capacity = n; \
 } \
 \
 __VA_ARGS__ void prefix ## Fill(struct_t *this, size_t n, T value) { \
@@ -182,12 +235,14 @@ __VA_ARGS__ T *prefix ## Back(const struct_t *this) { \
 } \
 __VA_ARGS__ struct_t prefix ## Move(struct_t *this) { \
     struct_t ret = *this; \
-    *this = prefix ## New(); \
+    __ ## prefix ## clear(this); \
     return ret; \
 } \
 \
 __VA_ARGS__ struct_t prefix ## Dup(const struct_t *this) { \
-    struct_t ret = prefix ## NewWithCap(this->length); \
+    struct_t ret = *this; \
+    __ ## prefix ## clear(&ret); \
+    prefix ## Reserve(&ret, this->length); \
     ret.length = this->length; \
     if (duplicator) { \
         for (size_t i = 0; i < ret.length; ++i) { \
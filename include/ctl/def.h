@@ -6,4 +6,15 @@
  */
 typedef void (*TCleanup)(void *userdata);
 
+/**
+ * Storage class specifier for thread-local variables.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define CTL_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define CTL_THREAD_LOCAL __declspec(thread)
+#else
+#define CTL_THREAD_LOCAL __thread
+#endif
+
 #endif
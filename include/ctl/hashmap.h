@@ -1,36 +1,297 @@
 #ifndef CTL_HASHMAP_H
 #define CTL_HASHMAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "ctl/def.h"
 #include "ctl/str.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Control byte of a slot which was never used.
+ * Full slots store the low 7 bits of the hash of their key instead, and every control byte with the high bit set is free.
+ */
+#define _THASHMAP_EMPTY ((uint8_t)0x80)
+
+/**
+ * Control byte of a slot whose key was erased.
+ */
+#define _THASHMAP_DELETED ((uint8_t)0xFE)
+
+#if defined(__SSE2__)
+/**
+ * Number of control bytes which are examined at once.
+ */
+#define _THASHMAP_GROUP_WIDTH 16
+
+/**
+ * One bit for each control byte of a group.
+ */
+typedef uint32_t _THashmapMask;
+
+static inline __m128i _thashmapGroupLoad(const uint8_t *ctrl) {
+    return _mm_loadu_si128((const __m128i *)ctrl);
+}
+
+/**
+ * Returns the slots of the group starting at `ctrl` whose control byte is `h2`.
+ */
+static inline _THashmapMask _thashmapMatch(const uint8_t *ctrl, uint8_t h2) {
+    __m128i match = _mm_cmpeq_epi8(_thashmapGroupLoad(ctrl), _mm_set1_epi8((char)h2));
+    return (_THashmapMask)_mm_movemask_epi8(match);
+}
+
+/**
+ * Returns the empty slots of the group starting at `ctrl`.
+ */
+static inline _THashmapMask _thashmapMatchEmpty(const uint8_t *ctrl) {
+    return _thashmapMatch(ctrl, _THASHMAP_EMPTY);
+}
+
+/**
+ * Returns the empty and deleted slots of the group starting at `ctrl`.
+ */
+static inline _THashmapMask _thashmapMatchFree(const uint8_t *ctrl) {
+    return (_THashmapMask)_mm_movemask_epi8(_thashmapGroupLoad(ctrl));
+}
+
+/**
+ * Returns the index of the first slot in `mask`, which must not be `0`.
+ */
+static inline unsigned _thashmapMaskFirst(_THashmapMask mask) {
+    return (unsigned)__builtin_ctz(mask);
+}
+
+/**
+ * Returns the number of slots before the first one in `mask`, \ref "_THASHMAP_GROUP_WIDTH" if there are none.
+ */
+static inline unsigned _thashmapMaskLeading(_THashmapMask mask) {
+    return mask ? (unsigned)__builtin_ctz(mask) : _THASHMAP_GROUP_WIDTH;
+}
+
+/**
+ * Returns the number of slots after the last one in `mask`, \ref "_THASHMAP_GROUP_WIDTH" if there are none.
+ */
+static inline unsigned _thashmapMaskTrailing(_THashmapMask mask) {
+    return mask ? (unsigned)__builtin_clz(mask) - (32 - _THASHMAP_GROUP_WIDTH) : _THASHMAP_GROUP_WIDTH;
+}
+#else
+#define _THASHMAP_GROUP_WIDTH 8
+
+// Without SIMD, a group is a 64-bit word and a mask has the high bit of each matching byte set
+typedef uint64_t _THashmapMask;
+
+#define _THASHMAP_LSB UINT64_C(0x0101010101010101)
+#define _THASHMAP_MSB UINT64_C(0x8080808080808080)
+
+static inline uint64_t _thashmapGroupLoad(const uint8_t *ctrl) {
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof group);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+
+    return group;
+}
+
+static inline unsigned _thashmapCtz64(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(n);
+#else
+    unsigned i = 0;
+    while (!(n & 1)) {
+        n >>= 1;
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+static inline unsigned _thashmapClz64(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_clzll(n);
+#else
+    unsigned i = 0;
+    while (!(n & (UINT64_C(1) << 63))) {
+        n <<= 1;
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+// May report a byte after a real match as a false positive, which only costs a key comparison
+static inline _THashmapMask _thashmapMatch(const uint8_t *ctrl, uint8_t h2) {
+    uint64_t x = _thashmapGroupLoad(ctrl) ^ (_THASHMAP_LSB * h2);
+    return (x - _THASHMAP_LSB) & ~x & _THASHMAP_MSB;
+}
+
+static inline _THashmapMask _thashmapMatchEmpty(const uint8_t *ctrl) {
+    // Only `_THASHMAP_EMPTY` has the high bit set and bit 1 clear
+    uint64_t group = _thashmapGroupLoad(ctrl);
+    return group & (~group << 6) & _THASHMAP_MSB;
+}
+
+static inline _THashmapMask _thashmapMatchFree(const uint8_t *ctrl) {
+    return _thashmapGroupLoad(ctrl) & _THASHMAP_MSB;
+}
+
+static inline unsigned _thashmapMaskFirst(_THashmapMask mask) {
+    return _thashmapCtz64(mask) / 8;
+}
+
+static inline unsigned _thashmapMaskLeading(_THashmapMask mask) {
+    return mask ? _thashmapCtz64(mask) / 8 : _THASHMAP_GROUP_WIDTH;
+}
+
+static inline unsigned _thashmapMaskTrailing(_THashmapMask mask) {
+    return mask ? _thashmapClz64(mask) / 8 : _THASHMAP_GROUP_WIDTH;
+}
+#endif
+
+/**
+ * Removes the first slot from `mask`.
+ */
+static inline _THashmapMask _thashmapMaskNext(_THashmapMask mask) {
+    return mask & (mask - 1);
+}
+
+/**
+ * Walks the groups of a table quadratically, which visits every group once before repeating.
+ */
+typedef struct {
+    size_t pos;     /**< First slot of the current group */
+    size_t stride;  /**< Distance to the next group */
+    size_t mask;    /**< Number of slots minus one */
+} _THashmapProbe;
+
+static inline _THashmapProbe _thashmapProbeNew(uint64_t hash, size_t capacity) {
+    return (_THashmapProbe) {
+        .pos = (size_t)(hash >> 7) & (capacity - 1),
+        .stride = 0,
+        .mask = capacity - 1,
+    };
+}
+
+static inline void _thashmapProbeNext(_THashmapProbe *this) {
+    this->stride += _THASHMAP_GROUP_WIDTH;
+    this->pos = (this->pos + this->stride) & this->mask;
+}
+
+/**
+ * Returns the control byte of a full slot whose key hashes to `hash`.
+ */
+static inline uint8_t _thashmapFragment(uint64_t hash) {
+    return (uint8_t)(hash & 0x7F);
+}
+
+/**
+ * Sets the control byte of `index`, and its copy after the end if it is in the first group.
+ */
+static inline void _thashmapSetCtrl(uint8_t *ctrl, size_t capacity, size_t index, uint8_t value) {
+    ctrl[index] = value;
+    ctrl[((index - _THASHMAP_GROUP_WIDTH) & (capacity - 1)) + _THASHMAP_GROUP_WIDTH] = value;
+}
+
+/**
+ * Returns the first empty or deleted slot on the probe sequence of `hash`. The table must have one.
+ */
+static inline size_t _thashmapFindFree(const uint8_t *ctrl, size_t capacity, uint64_t hash) {
+    _THashmapProbe probe = _thashmapProbeNew(hash, capacity);
+
+    for (;;) {
+        _THashmapMask free_slots = _thashmapMatchFree(ctrl + probe.pos);
+        if (free_slots) {
+            return (probe.pos + _thashmapMaskFirst(free_slots)) & probe.mask;
+        }
+
+        _thashmapProbeNext(&probe);
+    }
+}
+
+/**
+ * Returns the control byte the full slot `index` gets when its key is erased.
+ * If every group containing the slot also contains an empty slot, no lookup ever probed past it
+ * and it can become empty again. Otherwise it has to stay deleted.
+ */
+static inline uint8_t _thashmapErasedCtrl(const uint8_t *ctrl, size_t capacity, size_t index) {
+    size_t before = (index - _THASHMAP_GROUP_WIDTH) & (capacity - 1);
+
+    unsigned empty_before = _thashmapMaskTrailing(_thashmapMatchEmpty(ctrl + before));
+    unsigned empty_after = _thashmapMaskLeading(_thashmapMatchEmpty(ctrl + index));
+
+    return empty_before + empty_after < _THASHMAP_GROUP_WIDTH ? _THASHMAP_EMPTY : _THASHMAP_DELETED;
+}
+
 typedef struct {
     void *data;
     TString key;
+    uint64_t hash;  /**< Full hash of `key`, compared before the key itself and reused when the map grows */
 } _THashmapItem;
 
+/**
+ * Default value of `THashmap.max_load`.
+ */
+#define THASHMAP_DEFAULT_MAX_LOAD 0.875
+
+/**
+ * The slots a \ref "THashmap" is moving its keys out of while it grows incrementally.
+ */
 typedef struct {
-    size_t length, capacity;
-    _THashmapItem *items;
-} _THashmapBucket;
+    size_t capacity;        /**< Number of slots, `0` if no keys are being moved */
+    size_t length;          /**< Number of keys which were not moved yet */
+    size_t next;            /**< Index of the next slot to move */
+    uint8_t *ctrl;          /**< Control bytes, laid out like `THashmap.ctrl` */
+    _THashmapItem *slots;   /**< The slot array, which also owns `ctrl` */
+} _THashmapOldTable;
 
 /**
  * \ref "THashmap" is a hashmap implementation which hashes \ref "TStringView"
- * keys using FNV-1a.
+ * keys using \ref "tsvHashSeeded".
+ * Every map gets its own random seed, so the slot of a key can't be predicted from outside the process.
+ *
+ * Items are stored in a single array of slots using open addressing. Each slot has a control byte holding
+ * 7 bits of the hash of its key, and the control bytes are scanned a group at a time (16 with SSE2, 8 otherwise),
+ * so keys are only compared when those 7 bits match.
+ *
+ * The slot array grows once the number of keys would exceed `max_load` times its capacity. By default every key is
+ * moved at once when that happens. If `incremental` is set, the previous slots are kept instead and every later
+ * \ref "tHashmapSet" moves a few of their keys, so no single call pays for the whole move.
+ * Large slot arrays are mapped directly where the platform supports it, and the previous slots are unmapped
+ * piece by piece as their keys move. The call which grows the map still allocates the new slots and clears their
+ * control bytes, which is proportional to the new capacity (a few milliseconds for millions of slots).
+ * \ref "tHashmapReserve" and \ref "tHashmapSetMaxLoad" finish a pending move at once.
  */
 typedef struct {
-    size_t n_buckets;           /**< Length of the bucket array */
-    _THashmapBucket *buckets;   /**< The bucket array */
+    size_t capacity;            /**< Number of slots, `0` or a power of two which is at least \ref "_THASHMAP_GROUP_WIDTH" */
+    size_t length;              /**< Number of keys, including the ones in `old` */
+    size_t growth_left;         /**< Number of empty slots which can be filled before the slots are reallocated */
+    uint8_t *ctrl;              /**< One control byte per slot, followed by copies of the first \ref "_THASHMAP_GROUP_WIDTH" */
+    _THashmapItem *slots;       /**< The slot array, which also owns `ctrl` */
+    _THashmapOldTable old;      /**< Slots which are still being moved out of */
+    double max_load;            /**< Highest ratio of keys to slots, see \ref "tHashmapSetMaxLoad" */
+    bool incremental;           /**< Whether growing moves the keys a few at a time, may be changed at any time */
     TCleanup item_destructor;   /**< Callback function to be called when a key is overwritten or erased */
+    uint64_t seed;              /**< Seed passed to \ref "tsvHashSeeded" */
 } THashmap;
 
 /**
- * Creates a hashmap with `n_buckets` buckets.
+ * Creates a hashmap with room for `n_buckets` keys before it has to grow.
  */
 THashmap tHashmapNew(size_t n_buckets);
 
 /**
- * Creates a hashmap with `n_buckets` buckets and a destructor.
+ * Creates a hashmap with room for `n_buckets` keys and a destructor.
  * \param destructor A callback to be called when a key's value is overwritten or the key is erased
  */
 THashmap tHashmapNewCb(size_t n_buckets, TCleanup destructor);
@@ -49,10 +310,493 @@ void tHashmapSet(THashmap *this, TStringView key, void *data);
  */
 void *tHashmapGet(const THashmap *this, TStringView key);
 
+/**
+ * Hashes `key` the way `this` does, for use with the `Hashed` functions.
+ * The result is only valid for `this`, since every map has its own seed.
+ * \code{c}
+ * uint64_t hash = tHashmapHash(&map, key);
+ *
+ * if (!tHashmapGetHashed(&map, key, hash)) {
+ *     tHashmapSetHashed(&map, key, hash, makeValue());
+ * }
+ * \endcode
+ */
+uint64_t tHashmapHash(const THashmap *this, TStringView key);
+
+/**
+ * Same as \ref "tHashmapSet", with the hash of `key` computed in advance.
+ * \param hash The result of \ref "tHashmapHash" for `key` and `this`
+ */
+void tHashmapSetHashed(THashmap *this, TStringView key, uint64_t hash, void *data);
+
+/**
+ * Same as \ref "tHashmapGet", with the hash of `key` computed in advance.
+ * \param hash The result of \ref "tHashmapHash" for `key` and `this`
+ */
+void *tHashmapGetHashed(const THashmap *this, TStringView key, uint64_t hash);
+
+/**
+ * Finds the value of `key`, inserting the key if it does not exist, with a single lookup.
+ * A new key starts with a `NULL` value, which the caller must replace before calling any other function on the map.
+ * The returned reference is invalidated by the next call which may add keys.
+ * \code{c}
+ * bool inserted;
+ * void **value = tHashmapEntry(&counts, word, &inserted);
+ *
+ * if (inserted) {
+ *     *value = newCounter();
+ * }
+ *
+ * counterIncrement(*value);
+ * \endcode
+ * \param inserted Set to whether `key` was inserted
+ * \returns A reference to the value, or `NULL` if inserting fails
+ */
+void **tHashmapEntry(THashmap *this, TStringView key, bool *inserted);
+
+/**
+ * Same as \ref "tHashmapEntry", with the hash of `key` computed in advance.
+ * \param hash The result of \ref "tHashmapHash" for `key` and `this`
+ */
+void **tHashmapEntryHashed(THashmap *this, TStringView key, uint64_t hash, bool *inserted);
+
+/**
+ * Makes room for `n_keys` keys, so that the map does not grow until it holds more than that.
+ * Keys which are still being moved by an incremental resize are moved first.
+ * \returns `false` if the allocation fails, in which case the map is not modified
+ */
+bool tHashmapReserve(THashmap *this, size_t n_keys);
+
+/**
+ * Sets the highest ratio of keys to slots before the map grows.
+ * Lower values make lookups faster, especially for missing keys, at the cost of memory.
+ * Keys which are still being moved by an incremental resize are moved first.
+ * \param max_load The new ratio, clamped between `0.25` and `0.9375`. `0` restores \ref "THASHMAP_DEFAULT_MAX_LOAD".
+ */
+void tHashmapSetMaxLoad(THashmap *this, double max_load);
+
 /**
  * Destructs all values and deallocates all memory associated with `this`.
  * If `this->destructor` is not `NULL`, it is invoked for every value.
  */
 void tHashmapFree(THashmap *this);
 
+/**
+ * Scrambles the result of a user supplied hash function, so that functions which only spread their keys over
+ * some bits (like the identity for integers) still use every slot and control byte.
+ */
+static inline uint64_t _thashmapMix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xFF51AFD7ED558CCD);
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/**
+ * Maximum number of keys a table generated by \ref "CTL_DEFINE_HASHMAP_EXT" with `capacity` slots holds before it grows.
+ */
+static inline size_t _thashmapMaxLength(size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+/**
+ * Smallest capacity of a table generated by \ref "CTL_DEFINE_HASHMAP_EXT" which holds `n_keys` keys, `0` on overflow.
+ */
+static inline size_t _thashmapCapacityFor(size_t n_keys) {
+    size_t capacity = _THASHMAP_GROUP_WIDTH < 16 ? 16 : _THASHMAP_GROUP_WIDTH;
+    while (_thashmapMaxLength(capacity) < n_keys) {
+        if (capacity > (size_t)-1 / 2) {
+            return 0;
+        }
+
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+/**
+ * Capacity to grow a full table generated by \ref "CTL_DEFINE_HASHMAP_EXT" to.
+ * Tables which are mostly deleted slots are rebuilt at the same size. Returns `0` on overflow.
+ */
+static inline size_t _thashmapGrownCapacity(size_t capacity, size_t length) {
+    size_t grown = _thashmapCapacityFor(length + 1);
+    if (grown != 0 && grown <= capacity) {
+        grown = length + 1 > _thashmapMaxLength(capacity) / 2 ? capacity * 2 : capacity;
+    }
+
+    return grown;
+}
+
+/**
+ * Size of the block holding `capacity` slots of `slot_size` bytes and their control bytes, `0` on overflow.
+ */
+static inline size_t _thashmapTableSize(size_t capacity, size_t slot_size) {
+    if (capacity == 0 || capacity > ((size_t)-1 - _THASHMAP_GROUP_WIDTH) / (slot_size + 1)) {
+        return 0;
+    }
+
+    return capacity * slot_size + capacity + _THASHMAP_GROUP_WIDTH;
+}
+
+/**
+ * Convenience macro to be used when minimal customisation is needed.
+ */
+#define CTL_DECLARE_HASHMAP(K, V, prefix) \
+CTL_DECLARE_HASHMAP_EXT(prefix, K, V, prefix) \
+
+/**
+ * Declares a hashmap type `struct_t` mapping keys of type `K` to values of type `V`, its entry type `struct_t ## Entry`
+ * and the functions defined by \ref "CTL_DEFINE_HASHMAP_EXT".
+ *
+ * \param struct_t Name of the hashmap type
+ * \param K        Type of the keys
+ * \param V        Type of the values
+ * \param prefix   A prefix to be prepended to all method functions (must be unique unless declared as static)
+ * \param ...      Extra and optional declarations specifiers (static, etc.). Same declarations must be passed to \ref "CTL_DEFINE_HASHMAP_EXT".
+ */
+#define CTL_DECLARE_HASHMAP_EXT(struct_t, K, V, prefix, ...) \
+typedef struct { \
+    K key; \
+    V value; \
+} struct_t ## Entry; \
+typedef struct { \
+    size_t capacity; \
+    size_t length; \
+    size_t growth_left; \
+    uint8_t *ctrl; \
+    struct_t ## Entry *slots; \
+} struct_t; \
+__VA_ARGS__ struct_t prefix ## New(void); \
+__VA_ARGS__ struct_t prefix ## NewWithCap(size_t n_keys); \
+__VA_ARGS__ void prefix ## Free(struct_t *this); \
+__VA_ARGS__ bool prefix ## Reserve(struct_t *this, size_t n_keys); \
+__VA_ARGS__ V *prefix ## Get(const struct_t *this, K key); \
+__VA_ARGS__ V *prefix ## Set(struct_t *this, K key, V value); \
+__VA_ARGS__ bool prefix ## Erase(struct_t *this, K key); \
+__VA_ARGS__ struct_t ## Entry *prefix ## Next(const struct_t *this, size_t *cursor); \
+__VA_ARGS__ struct_t prefix ## Dup(const struct_t *this); \
+
+/**
+ * Convenience macro to be used when minimal customisation is needed.
+ */
+#define CTL_DEFINE_HASHMAP(K, V, prefix, hash, eq) \
+CTL_DEFINE_HASHMAP_EXT(prefix, K, V, prefix, hash, eq, NULL, NULL, NULL, NULL) \
+
+/**
+ * Defines a hashmap with the same layout as \ref "THashmap" (open addressing, one control byte per slot), whose
+ * keys and values are stored in the slots themselves instead of being boxed.
+ * `hash` and `eq` are called directly, so they are inlined wherever the compiler can see them.
+ *
+ * \param struct_t          Name of the hashmap type, as passed to \ref "CTL_DECLARE_HASHMAP_EXT"
+ * \param K                 Type of the keys
+ * \param V                 Type of the values
+ * \param prefix            A prefix to be prepended to all method functions (must be unique unless declared as static)
+ * \param hash              A callable hashing a key, its result is mixed so it only has to be unique
+ * \param eq                A callable comparing two keys
+ * \param key_destructor    A callable which will be invoked for every key the map owns when it is erased
+ * \param value_destructor  A callable which will be invoked for every value the map owns when it is overwritten or erased
+ * \param key_duplicator    A callable which will be invoked for every key during `$Dup()`
+ * \param value_duplicator  A callable which will be invoked for every value during `$Dup()`
+ * \param ...               Extra and optional declarations specifiers (`static`, etc.). Same declarations must be passed to \ref "CTL_DECLARE_HASHMAP_EXT".
+ *
+ * Signatures (function or function pointer):
+ * \code{c}
+ * uint64_t hash(const K *key);
+ * bool eq(const K *a, const K *b);
+ * void key_destructor(K *key);
+ * void value_destructor(V *value);
+ * K key_duplicator(const K *key);
+ * V value_duplicator(const V *value);
+ * \endcode
+ *
+ * The destructors and duplicators may be `NULL`. In such case they will not be called.
+ * If a duplicator is `NULL`, a shallow copy will take place instead.
+ * The map grows when it is 7/8 full, and always moves every key at once.
+ *
+ * \code{c}
+ * static uint64_t hashU32(const uint32_t *key) { return *key; }
+ * static bool eqU32(const uint32_t *a, const uint32_t *b) { return *a == *b; }
+ *
+ * CTL_DECLARE_HASHMAP(uint32_t, double, PriceMap)
+ * CTL_DEFINE_HASHMAP(uint32_t, double, PriceMap, hashU32, eqU32)
+ *
+ * PriceMap prices = PriceMapNew();
+ * PriceMapSet(&prices, 17, 4.5);
+ *
+ * double *price = PriceMapGet(&prices, 17); // => 4.5
+ *
+ * size_t cursor = 0;
+ * PriceMapEntry *entry;
+ * while ((entry = PriceMapNext(&prices, &cursor))) {
+ *     printf("%u: %f\n", entry->key, entry->value);
+ * }
+ *
+ * PriceMapFree(&prices);
+ * \endcode
+ *
+ * This macro defines the following functions:
+ * \code{c}
+ * struct_t $New(void);                                         // Creates an empty map with nothing allocated
+ * struct_t $NewWithCap(size_t n_keys);                         // Creates an empty map with room for `n_keys` keys
+ * void $Free(struct_t *this);                                  // Calls the destructors for every entry, deallocates any owned memory and leaves `this` in a valid state
+ * bool $Reserve(struct_t *this, size_t n_keys);                // Makes room for `n_keys` keys, returns `false` if the allocation fails
+ * V *$Get(const struct_t *this, K key);                        // Gets a reference to the value of `key`, or `NULL` if it does not exist
+ * V *$Set(struct_t *this, K key, V value);                     // Takes ownership of `key` and `value` and returns a reference to the stored value
+ * bool $Erase(struct_t *this, K key);                          // Calls the destructors for the entry of `key` and removes it, returns `false` if it does not exist
+ * struct_t ## Entry *$Next(const struct_t *this, size_t *cursor); // Returns the entry after `*cursor` (start at `0`) and advances it, or `NULL` after the last one
+ * struct_t $Dup(const struct_t *this);                         // Creates a new map and populates it with the duplicators
+ * \endcode
+ *
+ * If `$Set()` finds `key` already in the map, the stored key is kept and `key` is passed to `key_destructor`.
+ * If it can't allocate, it returns `NULL` and ownership of `key` and `value` stays with the caller.
+ * References to values are invalidated by the next `$Set()`, `$Reserve()` or `$Free()` call.
+ */
+#define CTL_DEFINE_HASHMAP_EXT(struct_t, K, V, prefix, hash, eq, key_destructor, value_destructor, key_duplicator, value_duplicator, ...) \
+static void __ ## prefix ## gen_warnings(void) { \
+    typedef uint64_t (*hash_t)(const K *key); \
+    typedef bool (*eq_t)(const K *a, const K *b); \
+    typedef void (*key_destructor_t)(K *key); \
+    typedef void (*value_destructor_t)(V *value); \
+    typedef K (*key_dup_t)(const K *key); \
+    typedef V (*value_dup_t)(const V *value); \
+    hash_t _h = hash; \
+    eq_t _e = eq; \
+    key_destructor_t _kde = key_destructor; \
+    value_destructor_t _vde = value_destructor; \
+    key_dup_t _kdu = key_duplicator; \
+    value_dup_t _vdu = value_duplicator; \
+} \
+static uint64_t __ ## prefix ## hash(const K *key) { \
+    return _thashmapMix(hash(key)); \
+} \
+static void __ ## prefix ## destroy(struct_t ## Entry *entry) { \
+    if (key_destructor) { \
+        ((void (*)(K *))key_destructor)(&entry->key); \
+    } \
+    \
+    if (value_destructor) { \
+        ((void (*)(V *))value_destructor)(&entry->value); \
+    } \
+} \
+static struct_t ## Entry *__ ## prefix ## find(const struct_t *this, const K *key, uint64_t h) { \
+    if (this->capacity == 0) { \
+        return NULL; \
+    } \
+    \
+    uint8_t h2 = _thashmapFragment(h); \
+    _THashmapProbe probe = _thashmapProbeNew(h, this->capacity); \
+    \
+    for (;;) { \
+        const uint8_t *group = this->ctrl + probe.pos; \
+        \
+        for (_THashmapMask match = _thashmapMatch(group, h2); match; match = _thashmapMaskNext(match)) { \
+            struct_t ## Entry *entry = this->slots + ((probe.pos + _thashmapMaskFirst(match)) & probe.mask); \
+            if (eq(&entry->key, key)) { \
+                return entry; \
+            } \
+        } \
+        \
+        if (_thashmapMatchEmpty(group)) { \
+            return NULL; \
+        } \
+        \
+        _thashmapProbeNext(&probe); \
+    } \
+} \
+static bool __ ## prefix ## resize(struct_t *this, size_t capacity) { \
+    size_t n_bytes = _thashmapTableSize(capacity, sizeof(struct_t ## Entry)); \
+    if (n_bytes == 0) { \
+        return false; \
+    } \
+    \
+    struct_t ## Entry *slots = malloc(n_bytes); \
+    if (!slots) { \
+        return false; \
+    } \
+    \
+    uint8_t *ctrl = (uint8_t *)(slots + capacity); \
+    memset(ctrl, _THASHMAP_EMPTY, capacity + _THASHMAP_GROUP_WIDTH); \
+    \
+    for (size_t i = 0; i < this->capacity; ++i) { \
+        if (this->ctrl[i] & 0x80) { \
+            continue; \
+        } \
+        \
+        uint64_t h = __ ## prefix ## hash(&this->slots[i].key); \
+        size_t index = _thashmapFindFree(ctrl, capacity, h); \
+        \
+        _thashmapSetCtrl(ctrl, capacity, index, _thashmapFragment(h)); \
+        slots[index] = this->slots[i]; \
+    } \
+    \
+    free(this->slots); \
+    \
+    this->capacity = capacity; \
+    this->growth_left = _thashmapMaxLength(capacity) - this->length; \
+    this->ctrl = ctrl; \
+    this->slots = slots; \
+    return true; \
+} \
+\
+__VA_ARGS__ struct_t prefix ## New(void) { \
+    struct_t this = { \
+        .capacity = 0, \
+        .length = 0, \
+        .growth_left = 0, \
+        .ctrl = NULL, \
+        .slots = NULL, \
+    }; \
+    \
+    return this; \
+} \
+\
+__VA_ARGS__ struct_t prefix ## NewWithCap(size_t n_keys) { \
+    struct_t this = prefix ## New(); \
+    prefix ## Reserve(&this, n_keys); \
+    return this; \
+} \
+\
+__VA_ARGS__ void prefix ## Free(struct_t *this) { \
+    if (key_destructor || value_destructor) { \
+        for (size_t i = 0; i < this->capacity; ++i) { \
+            if (!(this->ctrl[i] & 0x80)) { \
+                __ ## prefix ## destroy(this->slots + i); \
+            } \
+        } \
+    } \
+    \
+    free(this->slots); \
+    *this = prefix ## New(); \
+} \
+\
+__VA_ARGS__ bool prefix ## Reserve(struct_t *this, size_t n_keys) { \
+    if (this->capacity != 0 && _thashmapMaxLength(this->capacity) >= n_keys) { \
+        return true; \
+    } \
+    \
+    size_t capacity = _thashmapCapacityFor(n_keys > this->length ? n_keys : this->length); \
+    return capacity != 0 && __ ## prefix ## resize(this, capacity); \
+} \
+\
+__VA_ARGS__ V *prefix ## Get(const struct_t *this, K key) { \
+    struct_t ## Entry *entry = __ ## prefix ## find(this, &key, __ ## prefix ## hash(&key)); \
+    return entry ? &entry->value : NULL; \
+} \
+\
+__VA_ARGS__ V *prefix ## Set(struct_t *this, K key, V value) { \
+    uint64_t h = __ ## prefix ## hash(&key); \
+    \
+    struct_t ## Entry *entry = __ ## prefix ## find(this, &key, h); \
+    if (entry) { \
+        if (value_destructor) { \
+            ((void (*)(V *))value_destructor)(&entry->value); \
+        } \
+        \
+        if (key_destructor) { \
+            ((void (*)(K *))key_destructor)(&key); \
+        } \
+        \
+        entry->value = value; \
+        return &entry->value; \
+    } \
+    \
+    /* Reusing a deleted slot is always possible, filling an empty one may need more room first */ \
+    size_t index = 0; \
+    bool fits = this->capacity != 0; \
+    if (fits) { \
+        index = _thashmapFindFree(this->ctrl, this->capacity, h); \
+        fits = this->growth_left > 0 || this->ctrl[index] == _THASHMAP_DELETED; \
+    } \
+    \
+    if (!fits) { \
+        size_t capacity = this->capacity ? _thashmapGrownCapacity(this->capacity, this->length) : _thashmapCapacityFor(1); \
+        if (capacity == 0 || !__ ## prefix ## resize(this, capacity)) { \
+            return NULL; \
+        } \
+        \
+        index = _thashmapFindFree(this->ctrl, this->capacity, h); \
+    } \
+    \
+    if (this->ctrl[index] == _THASHMAP_EMPTY) { \
+        --this->growth_left; \
+    } \
+    \
+    _thashmapSetCtrl(this->ctrl, this->capacity, index, _thashmapFragment(h)); \
+    this->slots[index].key = key; \
+    this->slots[index].value = value; \
+    ++this->length; \
+    \
+    return &this->slots[index].value; \
+} \
+\
+__VA_ARGS__ bool prefix ## Erase(struct_t *this, K key) { \
+    struct_t ## Entry *entry = __ ## prefix ## find(this, &key, __ ## prefix ## hash(&key)); \
+    if (!entry) { \
+        return false; \
+    } \
+    \
+    __ ## prefix ## destroy(entry); \
+    \
+    size_t index = (size_t)(entry - this->slots); \
+    uint8_t ctrl = _thashmapErasedCtrl(this->ctrl, this->capacity, index); \
+    if (ctrl == _THASHMAP_EMPTY) { \
+        ++this->growth_left; \
+    } \
+    \
+    _thashmapSetCtrl(this->ctrl, this->capacity, index, ctrl); \
+    --this->length; \
+    return true; \
+} \
+\
+__VA_ARGS__ struct_t ## Entry *prefix ## Next(const struct_t *this, size_t *cursor) { \
+    for (size_t i = *cursor; i < this->capacity; ++i) { \
+        if (!(this->ctrl[i] & 0x80)) { \
+            *cursor = i + 1; \
+            return this->slots + i; \
+        } \
+    } \
+    \
+    *cursor = this->capacity; \
+    return NULL; \
+} \
+\
+__VA_ARGS__ struct_t prefix ## Dup(const struct_t *this) { \
+    struct_t dup = prefix ## New(); \
+    if (this->capacity == 0) { \
+        return dup; \
+    } \
+    \
+    size_t n_bytes = _thashmapTableSize(this->capacity, sizeof(struct_t ## Entry)); \
+    struct_t ## Entry *slots = malloc(n_bytes); \
+    if (!slots) { \
+        return dup; \
+    } \
+    \
+    /* Same capacity and hash, so every entry stays in its slot */ \
+    memcpy(slots, this->slots, n_bytes); \
+    \
+    if (key_duplicator || value_duplicator) { \
+        for (size_t i = 0; i < this->capacity; ++i) { \
+            if (this->ctrl[i] & 0x80) { \
+                continue; \
+            } \
+            \
+            if (key_duplicator) { \
+                slots[i].key = ((K (*)(const K *))key_duplicator)(&this->slots[i].key); \
+            } \
+            \
+            if (value_duplicator) { \
+                slots[i].value = ((V (*)(const V *))value_duplicator)(&this->slots[i].value); \
+            } \
+        } \
+    } \
+    \
+    dup = *this; \
+    dup.slots = slots; \
+    dup.ctrl = (uint8_t *)(slots + this->capacity); \
+    return dup; \
+} \
+
 #endif
@@ -0,0 +1,130 @@
+#ifndef CTL_INTERN_H
+#define CTL_INTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ctl/alloc.h"
+#include "ctl/str.h"
+
+/**
+ * Storage of an interned string, the characters follow the header.
+ */
+typedef struct {
+    uint64_t hash;  /**< The value of `tsvHash` for the string */
+    size_t length;  /**< Length of the string, without the null terminator */
+    uint32_t id;    /**< Id of the atom */
+    char data[];    /**< The null terminated string */
+} _TInternEntry;
+
+/**
+ * Handle to a string stored in a \ref "TInternPool".
+ * Two atoms from the same pool are equal if and only if their strings are equal,
+ * so comparing them is an integer compare instead of a string compare.
+ * Atoms stay valid until the pool is freed.
+ * The zero-initialised atom represents "no string".
+ */
+typedef struct {
+    uint32_t id;        /**< Unique within the pool, assigned in order of interning starting from `1` */
+    const char *data;   /**< The interned null terminated string */
+} TAtom;
+
+typedef struct _TInternTable {
+    struct _TInternTable *prev;     /**< Table this one replaced */
+    size_t mask;                    /**< Number of slots minus one */
+    const _TInternEntry *slots[];   /**< Open addressing table with linear probing */
+} _TInternTable;
+
+/**
+ * \ref "TInternPool" stores each distinct string once and hands out a \ref "TAtom" for it.
+ * The strings are kept in a chained \ref "TArena", so they never move.
+ * Looking up strings which are already interned is lock-free and may happen from any number of threads,
+ * while adding new strings is serialised by a spinlock.
+ * \code{c}
+ * TInternPool pool = tinternNew();
+ *
+ * TAtom a = tinternGet(&pool, tsvNewFromL("width"));
+ * TAtom b = tinternGet(&pool, tsvNewFromL("width"));
+ *
+ * printf("%s\n", tatomEq(a, b) ? "true" : "false"); // => true
+ *
+ * tinternFree(&pool);
+ * \endcode
+ */
+typedef struct {
+    _TInternTable *table;   /**< Current table, replaced as a whole when it grows */
+    _TInternTable *retired; /**< Replaced tables, kept alive until the pool is freed since readers may still use them */
+    TArena storage;         /**< Arena holding the entries */
+    uint32_t n_atoms;       /**< Number of interned strings */
+    int lock;               /**< Held while adding strings */
+} TInternPool;
+
+/**
+ * Creates an empty interning pool.
+ * \returns The pool, or a zero-initialised struct if the allocation fails
+ */
+TInternPool tinternNew(void);
+
+/**
+ * Interns `sv`, adding it to the pool if it is not present yet.
+ * May be called concurrently with other calls to this function and \ref "tinternFind".
+ * \returns The atom of `sv`, or a zero-initialised atom if the allocation fails
+ */
+TAtom tinternGet(TInternPool *this, TStringView sv);
+
+/**
+ * Looks up `sv` without adding it to the pool.
+ * This never takes the lock of the pool.
+ * \returns The atom of `sv`, or a zero-initialised atom if it was not interned
+ */
+TAtom tinternFind(const TInternPool *this, TStringView sv);
+
+/**
+ * \returns The number of distinct strings in the pool
+ */
+size_t tinternCount(const TInternPool *this);
+
+/**
+ * Deallocates the pool and every string in it, invalidating all of its atoms.
+ * Must not be called while other threads use the pool.
+ */
+void tinternFree(TInternPool *this);
+
+static inline const _TInternEntry *_tatomEntry(TAtom atom) {
+    return (const _TInternEntry *)(atom.data - offsetof(_TInternEntry, data));
+}
+
+/**
+ * Compares two atoms of the same pool.
+ */
+static inline bool tatomEq(TAtom a, TAtom b) {
+    return a.id == b.id;
+}
+
+/**
+ * \returns A view of the interned string, or an empty view for the zero atom
+ */
+static inline TStringView tatomView(TAtom atom) {
+    if (!atom.data) {
+        return (TStringView) { 0 };
+    }
+
+    return tsvNewFromBuf((const unsigned char *)atom.data, _tatomEntry(atom)->length);
+}
+
+/**
+ * \returns The length of the interned string
+ */
+static inline size_t tatomLength(TAtom atom) {
+    return atom.data ? _tatomEntry(atom)->length : 0;
+}
+
+/**
+ * \returns The value of `tsvHash` for the interned string, computed once when the string was interned
+ */
+static inline uint64_t tatomHash(TAtom atom) {
+    return atom.data ? _tatomEntry(atom)->hash : tsvHash((TStringView) { 0 });
+}
+
+#endif
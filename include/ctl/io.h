@@ -0,0 +1,141 @@
+#ifndef CTL_IO_H
+#define CTL_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ctl/alloc.h"
+#include "ctl/str.h"
+
+/**
+ * Default size of the buffer of a \ref "TRecordReader".
+ */
+#define TREADER_BUFFER_SIZE ((size_t)1024 * 1024)
+
+/**
+ * How the contents of a \ref "TFileView" are going to be accessed, which decides how the system reads ahead.
+ */
+typedef enum {
+    TFVIEW_NORMAL,      /**< No particular pattern */
+    TFVIEW_SEQUENTIAL,  /**< Mostly from start to end, pages are read ahead aggressively and can be dropped once passed */
+    TFVIEW_RANDOM,      /**< In no particular order, read-ahead is disabled */
+} TFileViewAccess;
+
+/**
+ * \ref "TFileView" makes the contents of a file available as a \ref "TStringView" without copying them.
+ * The file is memory mapped read-only where the platform supports it, and read into a buffer otherwise.
+ * Mapped pages are only loaded as they are touched, so a view of a file much larger than the available
+ * memory can be created.
+ * \code{c}
+ * TFileView file;
+ * if (!tfviewOpen(&file, "input.csv", TFVIEW_SEQUENTIAL)) {
+ *     // ...
+ * }
+ *
+ * TSplitIter it = tsvSplitLines(tfviewGet(&file));
+ * // ...
+ *
+ * tfviewFree(&file);
+ * \endcode
+ */
+typedef struct {
+    void *data;     /**< The contents of the file, `NULL` if it is empty */
+    size_t length;  /**< Size of the file */
+    bool mapped;    /**< Whether `data` is a memory mapping or a `malloc`ed buffer */
+} TFileView;
+
+/**
+ * \ref "TRecordReader" splits a file descriptor into records, returning each one as a view into a reusable buffer.
+ * Use it instead of a \ref "TFileView" for pipes, sockets, and files too large to map.
+ * Nothing is copied except the unfinished record at the end of the buffer, which is moved to the front before reading more.
+ * The buffer grows if a single record does not fit into it.
+ * \code{c}
+ * TRecordReader reader = treaderNew(STDIN_FILENO, TREADER_BUFFER_SIZE);
+ *
+ * TStringView line;
+ * while (treaderNextLine(&reader, &line)) {
+ *     // `line` is valid until the next call
+ * }
+ *
+ * if (treaderFailed(&reader)) {
+ *     // ...
+ * }
+ *
+ * treaderFree(&reader);
+ * \endcode
+ */
+typedef struct {
+    char *buffer;                   /**< The buffer, allocated on the first read */
+    size_t capacity;                /**< Size of `buffer` */
+    size_t start;                   /**< Start of the unread data in `buffer` */
+    size_t end;                     /**< End of the data in `buffer` */
+    size_t scanned;                 /**< End of the unread data which is known not to contain the delimiter */
+    int fd;                         /**< The file descriptor, not owned by the reader */
+    bool eof;                       /**< Whether the end of the input was reached */
+    bool failed;                    /**< Whether reading or allocating failed */
+    TDynamicAllocator *allocator;   /**< Allocator which owns `buffer`, or `NULL` for libc (must outlive the reader) */
+} TRecordReader;
+
+/**
+ * Opens the file at `path` and creates a view of its contents.
+ * \param access Hint about how the view will be used
+ * \returns `false` if the file can't be opened or mapped, in which case `this` is left empty
+ */
+bool tfviewOpen(TFileView *this, const char *path, TFileViewAccess access);
+
+/**
+ * Returns a view of the contents, valid until \ref "tfviewFree" is called.
+ */
+TStringView tfviewGet(const TFileView *this);
+
+/**
+ * Asks the system to start loading `length` bytes starting at `offset` in the background, if the contents are mapped.
+ * The range is clamped to the size of the file.
+ */
+void tfviewPrefetch(const TFileView *this, size_t offset, size_t length);
+
+/**
+ * Unmaps or deallocates the contents and leaves `this` empty.
+ */
+void tfviewFree(TFileView *this);
+
+/**
+ * Creates a reader for `fd` with nothing allocated.
+ * \param buffer_size Initial size of the buffer, \ref "TREADER_BUFFER_SIZE" if `0`
+ */
+TRecordReader treaderNew(int fd, size_t buffer_size);
+
+/**
+ * Creates a reader for `fd` with nothing allocated, whose buffer will be allocated with `allocator`.
+ * \param buffer_size Initial size of the buffer, \ref "TREADER_BUFFER_SIZE" if `0`
+ * \param allocator The allocator to use, `NULL` to use libc. It is not owned by the reader and must outlive it.
+ */
+TRecordReader treaderNewWithAllocator(int fd, size_t buffer_size, TDynamicAllocator *allocator);
+
+/**
+ * Stores a view of the next record terminated by `delim` in `out`, without the delimiter.
+ * A final delimiter does not start another record, and an empty input has no records.
+ * The view is valid until the next call on the reader.
+ * \returns `false` at the end of the input or if reading fails, see \ref "treaderFailed"
+ */
+bool treaderNext(TRecordReader *this, char delim, TStringView *out);
+
+/**
+ * Stores a view of the next line in `out`, following the rules of \ref "tsvSplitLines".
+ * The view is valid until the next call on the reader.
+ * \returns `false` at the end of the input or if reading fails, see \ref "treaderFailed"
+ */
+bool treaderNextLine(TRecordReader *this, TStringView *out);
+
+/**
+ * Checks whether the reader stopped because reading or growing the buffer failed, or because the
+ * platform can't read from file descriptors.
+ */
+bool treaderFailed(const TRecordReader *this);
+
+/**
+ * Deallocates the buffer. The file descriptor is not closed.
+ */
+void treaderFree(TRecordReader *this);
+
+#endif
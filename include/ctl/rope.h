@@ -0,0 +1,141 @@
+#ifndef CTL_ROPE_H
+#define CTL_ROPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "ctl/alloc.h"
+#include "ctl/str.h"
+
+/**
+ * Size of a regular rope segment, including its header.
+ */
+#define TROPE_SEGMENT_SIZE ((size_t)64 * 1024)
+
+/**
+ * A contiguous piece of a \ref "TRope".
+ * The characters are `data[start]` to `data[start + length - 1]`, the rest of `data` is free for
+ * appending (after the characters) and prepending (before them).
+ */
+typedef struct TRopeSegment {
+    struct TRopeSegment *prev;  /**< Previous segment, `NULL` for the first one */
+    struct TRopeSegment *next;  /**< Next segment, `NULL` for the last one */
+    size_t start;               /**< Offset of the first character in `data` */
+    size_t length;              /**< Number of characters in the segment */
+    size_t capacity;            /**< Size of `data` */
+    char data[];                /**< The memory region */
+} TRopeSegment;
+
+/**
+ * \ref "TRope" builds a string out of a linked list of segments, which are never moved once allocated.
+ * Unlike \ref "TString", growing it never copies what was already written and needs no more memory than the
+ * characters themselves (plus the free space of the last segment), which makes it suitable for very large outputs.
+ * Appending and prepending take time proportional to the appended data, inserting in the middle has to find
+ * the segment first and moves at most one segment's worth of characters.
+ * \code{c}
+ * TRope rope = tropeNew();
+ *
+ * tropeAppend(&rope, tsvNewFromL("world"));
+ * tropePrepend(&rope, tsvNewFromL("hello "));
+ *
+ * tropeWriteFile(&rope, stdout); // hello world
+ *
+ * tropeFree(&rope);
+ * \endcode
+ */
+typedef struct {
+    TRopeSegment *head;             /**< First segment */
+    TRopeSegment *tail;             /**< Last segment */
+    size_t length;                  /**< Total number of characters */
+    TDynamicAllocator *allocator;   /**< Allocator which owns the segments, or `NULL` for libc (must outlive the rope) */
+} TRope;
+
+/**
+ * Iterates over the characters of a \ref "TRope" one segment at a time, see \ref "tropeIterNext".
+ */
+typedef struct {
+    const TRopeSegment *segment; /**< The segment to return next */
+} TRopeIter;
+
+/**
+ * Creates an empty rope with nothing allocated.
+ */
+TRope tropeNew(void);
+
+/**
+ * Creates an empty rope with nothing allocated, whose segments will be allocated with `allocator`.
+ * \param allocator The allocator to use, `NULL` to use libc. It is not owned by the rope and must outlive it.
+ */
+TRope tropeNewWithAllocator(TDynamicAllocator *allocator);
+
+/**
+ * Appends `sv` to the end of the rope.
+ * \returns `false` if the allocation fails, in which case the rope is not modified
+ */
+bool tropeAppend(TRope *this, TStringView sv);
+
+/**
+ * Inserts `sv` at the start of the rope.
+ * \returns `false` if the allocation fails, in which case the rope is not modified
+ */
+bool tropePrepend(TRope *this, TStringView sv);
+
+/**
+ * Inserts `sv` before the character at `index`.
+ * \param index Position to insert at, `this->length` appends
+ * \returns `false` if `index` is out of bounds or the allocation fails, in which case the characters of the rope are not modified
+ */
+bool tropeInsert(TRope *this, size_t index, TStringView sv);
+
+/**
+ * Starts an iteration over the segments of `this`.
+ * The rope must not be modified while the iterator is in use.
+ * \code{c}
+ * TRopeIter it = tropeIter(&rope);
+ *
+ * TStringView piece;
+ * while (tropeIterNext(&it, &piece)) {
+ *     fwrite(piece.data, 1, piece.length, stdout);
+ * }
+ * \endcode
+ */
+TRopeIter tropeIter(const TRope *this);
+
+/**
+ * Stores a view of the next non-empty segment in `out`.
+ * \returns `false` if there are no segments left
+ */
+bool tropeIterNext(TRopeIter *this, TStringView *out);
+
+/**
+ * Copies the characters of the rope into a single string, allocated with the allocator of the rope.
+ * \returns The string, or an empty string if the allocation fails
+ */
+TString tropeFlatten(const TRope *this);
+
+/**
+ * Writes the characters of the rope to the file descriptor `fd`, gathering up to a few hundred segments per `writev` call.
+ * Partial writes and interrupted calls are retried.
+ * \returns `false` if writing fails, or if the platform has no `writev`
+ */
+bool tropeWriteFd(const TRope *this, int fd);
+
+/**
+ * Writes the characters of the rope to `file`.
+ * \returns `false` if writing fails
+ */
+bool tropeWriteFile(const TRope *this, FILE *file);
+
+/**
+ * Removes all characters, deallocating every segment.
+ * The allocator is kept.
+ */
+void tropeClear(TRope *this);
+
+/**
+ * Deallocates all memory associated with `this`.
+ */
+void tropeFree(TRope *this);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef CTL_SHARED_H
+#define CTL_SHARED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ctl/alloc.h"
+#include "ctl/str.h"
+
+/**
+ * The bookkeeping of a \ref "TSharedString", stored in the same allocation as the characters, right after them.
+ * Placing it after the characters lets a uniquely owned buffer be handed to a \ref "TString" as is.
+ */
+typedef struct {
+    size_t refcount;                /**< Number of handles, only accessed atomically */
+    size_t length;                  /**< Length of the string */
+    char *data;                     /**< The null-terminated characters, also the start of the allocation */
+    TDynamicAllocator *allocator;   /**< Allocator which owns the buffer, or `NULL` for libc */
+} _TSharedHeader;
+
+/**
+ * \ref "TSharedString" is an immutable, reference counted string.
+ * Duplicating a handle only increments the reference count, the characters are deallocated when the last handle is freed.
+ * The reference count is updated atomically, so handles to the same string can be duplicated and freed from different threads.
+ * \code{c}
+ * TString body = ...;
+ * TSharedString shared = tsharedFromStr(&body); // takes the buffer of `body` without copying
+ *
+ * TSharedString copy = tsharedDup(&shared);     // no allocation
+ * printf("%.*s\n", (int)tsharedLength(&copy), tsharedData(&copy));
+ *
+ * tsharedFree(&copy);
+ * tsharedFree(&shared);
+ * \endcode
+ */
+typedef struct {
+    _TSharedHeader *header; /**< The shared buffer, `NULL` for the empty string */
+} TSharedString;
+
+/**
+ * Creates a shared string holding a copy of `sv`.
+ * \returns The string, or an empty string if the allocation fails
+ */
+TSharedString tsharedNew(TStringView sv);
+
+/**
+ * Creates a shared string holding a copy of `sv`, allocated with `allocator`.
+ * \param allocator The allocator to use, `NULL` to use libc. It is not owned by the string and must outlive every handle.
+ * \returns The string, or an empty string if the allocation fails
+ */
+TSharedString tsharedNewWithAllocator(TStringView sv, TDynamicAllocator *allocator);
+
+/**
+ * Creates a shared string from `str`, which is left empty (but keeps its allocator).
+ * Heap allocated strings give up their buffer, which is resized at most once to make room for the header.
+ * \returns The string, or an empty string if the allocation fails, in which case `str` is not modified
+ */
+TSharedString tsharedFromStr(TString *str);
+
+/**
+ * Returns a new handle to the same characters, without allocating.
+ * Both handles must be freed.
+ */
+TSharedString tsharedDup(const TSharedString *this);
+
+/**
+ * Converts the handle into a mutable string, consuming it.
+ * If `this` was the only handle, the buffer is handed over without copying. Otherwise the characters are copied
+ * with the allocator of the string and the handle is released.
+ * \returns The string, or an empty string if the allocation fails
+ */
+TString tsharedIntoStr(TSharedString *this);
+
+/**
+ * Checks whether `this` is the only handle to its characters.
+ * The empty string is always unique.
+ */
+bool tsharedIsUnique(const TSharedString *this);
+
+/**
+ * Releases the handle, deallocating the characters if it was the last one.
+ */
+void tsharedFree(TSharedString *this);
+
+/**
+ * Returns the null-terminated characters of the string.
+ */
+static inline const char *tsharedData(const TSharedString *this) {
+    return this->header ? this->header->data : "";
+}
+
+/**
+ * Returns the length of the string.
+ */
+static inline size_t tsharedLength(const TSharedString *this) {
+    return this->header ? this->header->length : 0;
+}
+
+/**
+ * Creates a view of the characters of `this`, which stays valid for as long as the handle does.
+ */
+static inline TStringView tsvNewFromShared(const TSharedString *this) {
+    return (TStringView) {
+        .length = tsharedLength(this),
+        .data = tsharedData(this),
+    };
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "ctl/alloc.h"
+
 /**
  * Allocates a string from a string literal.
  * This macro will correctly handle string literals with null bytes, unlike \ref "tstrNewFromC".
@@ -45,16 +47,47 @@
  */
 #define tsvNewFromL(literal) tsvNewFromBuf((const unsigned char *)(literal), (sizeof literal) - 1)
 
+/**
+ * Size of the buffer embedded in \ref "TString".
+ * Strings shorter than this (excluding the null-terminator) are stored inside the struct and need no allocation.
+ */
+#define TSTR_INLINE_CAPACITY 24
+
 /**
  * \ref "TString" is a type which holds a reference to an owned region of memory representing a string.
  * Unless manually modified, the underlying region is guaranteed to be null-terminated.
+ * The region is allocated with `allocator`, or with libc `realloc` and `free` if it is `NULL`.
+ *
+ * Short strings are stored inline in `buf.small`, and `capacity` is at most \ref "TSTR_INLINE_CAPACITY" while this is the case.
+ * Longer strings are stored in `buf.heap`. Use \ref "tstrData" to access the characters in either case.
+ * Since the characters may live inside the struct, pointers and views obtained from a string
+ * are invalidated when the string is copied or moved to another location.
  */
 typedef struct {
-    size_t length;   /**< Length of the string excluding the null-terminator */
-    size_t capacity; /**< Size of the allocated memory region */
-    char *data;      /**< Pointer to the memory region */
+    size_t length;                  /**< Length of the string excluding the null-terminator */
+    size_t capacity;                /**< Size of the memory region */
+    union {
+        char *heap;                         /**< Pointer to the allocated memory region */
+        char small[TSTR_INLINE_CAPACITY];   /**< Inline memory region */
+    } buf;                          /**< The memory region, use \ref "tstrData" to access it */
+    TDynamicAllocator *allocator;   /**< Allocator which owns `buf.heap`, or `NULL` for libc (must outlive the string) */
 } TString;
 
+/**
+ * Returns a pointer to the characters of `this`, which is valid until `this` is modified, moved or freed.
+ * The characters are null-terminated unless manually modified.
+ */
+static inline char *tstrData(const TString *this) {
+    return this->capacity <= TSTR_INLINE_CAPACITY ? (char *)this->buf.small : this->buf.heap;
+}
+
+/**
+ * Whether the characters of `this` are stored inline instead of a separate allocation.
+ */
+static inline bool tstrIsInline(const TString *this) {
+    return this->capacity <= TSTR_INLINE_CAPACITY;
+}
+
 /**
  * \ref "TStringView" is a type which holds a reference to a **non**-owned region of memory representing a string slice.
  * Unlike \ref "TString", \ref "TStringView" does not guarantee a null-terminator.
@@ -66,9 +99,16 @@ typedef struct {
 
 /**
  * Creates an empty string with nothing allocated.
+ * The empty string is stored inline, so \ref "tstrData" returns a valid null-terminated string.
  */
 TString tstrNew(void);
 
+/**
+ * Creates an empty string with nothing allocated, whose memory will be allocated with `allocator`.
+ * \param allocator The allocator to use, `NULL` to use libc. It is not owned by the string and must outlive it.
+ */
+TString tstrNewWithAllocator(TDynamicAllocator *allocator);
+
 /**
  * Creates a \ref "TString" from a C-style null-terminated string.
  * The data in `cstr` is copied and not used after the function returns.
@@ -101,12 +141,7 @@ TString tstrNewFromBuf(const unsigned char *buf, size_t n);
 TString tstrNewFromView(TStringView view);
 
 /**
- * Duplicates the contents of `this` into a new string.
- *
- * This function is equivalent to:
- * \code{c}
- * tstrNewFromBuf((cosnt unsigned char *)this->data, this->length);
- * \endcode
+ * Duplicates the contents of `this` into a new string which uses the same allocator as `this`.
  */
 TString tstrDup(const TString *this);
 
@@ -140,46 +175,49 @@ TStringView tsvNewFromBuf(const unsigned char *buf, size_t n);
 
 /**
  * Wraps a \ref "TString" in a \ref "TStringView".
- * The returned string view is valid as long as `str` is alive.
+ * The returned string view is valid as long as `str` is alive and stays at the same location.
  * Changing `str->length` in any way, direct or indirect, will invalidate the view.
  *
  * This function is equivalent to:
  * \code{c}
- * tsvNewFromBuf((const unsigned char *)str->data, str->length);
+ * tsvNewFromBuf((const unsigned char *)tstrData(str), str->length);
  * \endcode
  */
 TStringView tsvNewFromStr(const TString *str);
 
 /**
  * Creates a \ref "TStringView" by selecting a portion of a \ref "TString".
- * The returned string view is valid as long as `str` is alive.
+ * The returned string view is valid as long as `str` is alive and stays at the same location.
  *
  * This function is equivalent to:
  * \code{c}
- * tsvNewFromBuf((const unsigned char *)str->data + start, length);
+ * tsvNewFromBuf((const unsigned char *)tstrData(str) + start, length);
  * \endcode
  */
 TStringView tsvNewFromStrBounds(const TString *str, size_t start, size_t length);
 
 /**
- * Transfers ownership of `old`'s buffer and leaves `old` in a valid state.
+ * Transfers ownership of `old`'s buffer and leaves `old` empty, still using the same allocator.
  * \returns The new string which owns the memory
  */
 TString tstrMove(TString *old);
 
 /**
  * Allocates space in the internal buffer for at least `min_cap` characters ahead of time.
+ * Nothing is allocated if `min_cap` fits in the inline buffer.
  */
 void tstrReserve(TString *this, size_t min_cap);
 
 /**
- * Resizes the internal buffer to be as tiny as possible to hold all characters.
+ * Resizes the internal buffer to be as tiny as possible to hold all characters and the null-terminator.
+ * Short enough strings are moved back to the inline buffer.
  */
 void tstrShrink(TString *this);
 
 /**
  * Deallocates any owned memory, invalidates all pointers and \ref "TStringView" objects referencing
  * this string and leaves `this` in a valid state.
+ * `this->allocator` is kept so that the string can be reused.
  */
 void tstrFree(TString *this);
 
@@ -203,6 +241,17 @@ void tstrCat(TString *this, TStringView that);
  */
 void tstrTrunc(TString *this, size_t new_len_max);
 
+/**
+ * Keeps at most the first `new_len_max` bytes in the string, without cutting a UTF-8 encoded codepoint in half.
+ * If the byte at `new_len_max` continues a codepoint, the string is cut before that codepoint instead.
+ */
+void tstrTruncUtf8(TString *this, size_t new_len_max);
+
+/**
+ * Constructs a view of at most the first `new_len_max` bytes of `sv`, without cutting a UTF-8 encoded codepoint in half.
+ */
+TStringView tsvTruncUtf8(TStringView sv, size_t new_len_max);
+
 /**
  * Compares two \ref "TString" objects by lexicographic order.
  * \returns A negative value if `this < that`, `0` if `this == that` and a positive value if `this > that`.
@@ -248,10 +297,65 @@ bool tsvEq(TStringView this, TStringView that);
 bool tsvEqC(TStringView this, const char *cstr);
 
 /**
- * Computes the FNV-1a hash of `sv`.
+ * Compares two \ref "TStringView" objects by lexicographic order, treating ASCII letters of different case as equal.
+ * \returns A negative value if `this < that`, `0` if `this == that` and a positive value if `this > that`.
+ */
+int tsvCmpNoCase(TStringView this, TStringView that);
+
+/**
+ * Determines whether two \ref "TStringView" objects are identical, treating ASCII letters of different case as equal.
+ */
+bool tsvEqNoCase(TStringView this, TStringView that);
+
+/**
+ * Determines whether `str` starts with `prefix`.
+ */
+bool tstrStartsWith(const TString *str, TStringView prefix);
+
+/**
+ * Determines whether `sv` starts with `prefix`.
+ */
+bool tsvStartsWith(TStringView sv, TStringView prefix);
+
+/**
+ * Determines whether `str` ends with `suffix`.
+ */
+bool tstrEndsWith(const TString *str, TStringView suffix);
+
+/**
+ * Determines whether `sv` ends with `suffix`.
+ */
+bool tsvEndsWith(TStringView sv, TStringView suffix);
+
+/**
+ * Determines whether `sv` starts with `prefix`, treating ASCII letters of different case as equal.
+ */
+bool tsvStartsWithNoCase(TStringView sv, TStringView prefix);
+
+/**
+ * Determines whether `sv` ends with `suffix`, treating ASCII letters of different case as equal.
+ */
+bool tsvEndsWithNoCase(TStringView sv, TStringView suffix);
+
+/**
+ * Computes a 64-bit hash of `sv`.
+ * The input is consumed 8 or 16 bytes at a time, which makes this much faster than \ref "tsvHashFnv1a" on all but the shortest keys.
+ * The result is stable within a build, but depends on the byte order of the target.
  */
 uint64_t tsvHash(TStringView sv);
 
+/**
+ * Computes the hash of `sv` like \ref "tsvHash", mixing in `seed`.
+ * Using a seed which is not known to the user makes it hard to craft keys which collide, see \ref "THashmap".
+ */
+uint64_t tsvHashSeeded(TStringView sv, uint64_t seed);
+
+/**
+ * Computes the FNV-1a hash of `sv`.
+ * This is what \ref "tsvHash" used to compute, it is kept for hashes which have to stay compatible.
+ */
+uint64_t tsvHashFnv1a(TStringView sv);
+
 /**
  * Finds any of the given chars in `str`.
  * \param candidates List of characters to search
@@ -261,11 +365,95 @@ size_t tstrIndexOfFirst(const TString *str, TStringView candidates);
 
 /**
  * Finds any of the given chars in `sv`.
+ * The search is vectorised (with SSE2, or AVX2 if the CPU supports it) on x86 targets.
  * \param candidates List of characters to search
  * \returns          The index of the first matching character, or `(size_t)-1` if not found
  */
 size_t tsvIndexOfFirst(TStringView sv, TStringView candidates);
 
+/**
+ * Finds the last occurrence of any of the given chars in `str`.
+ * \param candidates List of characters to search
+ * \returns          The index of the last matching character, or `(size_t)-1` if not found
+ */
+size_t tstrIndexOfLast(const TString *str, TStringView candidates);
+
+/**
+ * Finds the last occurrence of any of the given chars in `sv`.
+ * \param candidates List of characters to search
+ * \returns          The index of the last matching character, or `(size_t)-1` if not found
+ */
+size_t tsvIndexOfLast(TStringView sv, TStringView candidates);
+
+/**
+ * Finds the first char in `str` which is not one of the given chars.
+ * \param candidates List of characters to skip
+ * \returns          The index of the first non-matching character, or `(size_t)-1` if every character matches
+ */
+size_t tstrIndexOfFirstNot(const TString *str, TStringView candidates);
+
+/**
+ * Finds the first char in `sv` which is not one of the given chars.
+ * \param candidates List of characters to skip
+ * \returns          The index of the first non-matching character, or `(size_t)-1` if every character matches
+ */
+size_t tsvIndexOfFirstNot(TStringView sv, TStringView candidates);
+
+/**
+ * Finds the last char in `str` which is not one of the given chars.
+ * \param candidates List of characters to skip
+ * \returns          The index of the last non-matching character, or `(size_t)-1` if every character matches
+ */
+size_t tstrIndexOfLastNot(const TString *str, TStringView candidates);
+
+/**
+ * Finds the last char in `sv` which is not one of the given chars.
+ * \param candidates List of characters to skip
+ * \returns          The index of the last non-matching character, or `(size_t)-1` if every character matches
+ */
+size_t tsvIndexOfLastNot(TStringView sv, TStringView candidates);
+
+/**
+ * Finds the first occurrence of `needle` in `str`.
+ * \returns The index of the first occurrence, `0` if `needle` is empty, or `(size_t)-1` if not found
+ */
+size_t tstrFind(const TString *str, TStringView needle);
+
+/**
+ * Finds the first occurrence of `needle` in `sv`.
+ * Short needles are searched with a vectorised filter, long ones with the Two-Way algorithm,
+ * the search takes linear time in the worst case either way.
+ * \returns The index of the first occurrence, `0` if `needle` is empty, or `(size_t)-1` if not found
+ */
+size_t tsvFind(TStringView sv, TStringView needle);
+
+/**
+ * Finds the last occurrence of `needle` in `str`.
+ * \returns The index of the last occurrence, `str->length` if `needle` is empty, or `(size_t)-1` if not found
+ */
+size_t tstrFindLast(const TString *str, TStringView needle);
+
+/**
+ * Finds the last occurrence of `needle` in `sv`.
+ * \returns The index of the last occurrence, `sv.length` if `needle` is empty, or `(size_t)-1` if not found
+ */
+size_t tsvFindLast(TStringView sv, TStringView needle);
+
+/**
+ * Counts the non-overlapping occurrences of `needle` in `str`.
+ * \returns The number of occurrences, `0` if `needle` is empty
+ */
+size_t tstrCount(const TString *str, TStringView needle);
+
+/**
+ * Counts the non-overlapping occurrences of `needle` in `sv`.
+ * \code{c}
+ * tsvCount(tsvNewFromL("aaaa"), tsvNewFromL("aa")); // => 2
+ * \endcode
+ * \returns The number of occurrences, `0` if `needle` is empty
+ */
+size_t tsvCount(TStringView sv, TStringView needle);
+
 /**
  * Constructs a view which skips whitespace from each end of `str`.
  * \returns A view to `str` that does not include whitespace in any end
@@ -278,4 +466,140 @@ TStringView tstrStripSpaces(const TString *str);
  */
 TStringView tsvStripSpaces(TStringView sv);
 
+/**
+ * Checks whether `str` is valid UTF-8.
+ */
+bool tstrIsUtf8(const TString *str);
+
+/**
+ * Checks whether `sv` is valid UTF-8: no overlong encodings, surrogates, codepoints above `U+10FFFF`
+ * or truncated sequences. Vectorised with AVX2 if the CPU supports it.
+ */
+bool tsvIsUtf8(TStringView sv);
+
+/**
+ * Counts the codepoints in `str`, which is assumed to be valid UTF-8.
+ */
+size_t tstrUtf8Length(const TString *str);
+
+/**
+ * Counts the codepoints in `sv`, which is assumed to be valid UTF-8.
+ * Every byte which is not a continuation byte counts as a codepoint, so invalid input gives a meaningless but bounded result.
+ */
+size_t tsvUtf8Length(TStringView sv);
+
+/**
+ * Result of the number parsing functions.
+ */
+typedef enum {
+    TPARSE_OK = 0,      /**< A number was parsed */
+    TPARSE_INVALID,     /**< The view does not start with a number, nothing was consumed */
+    TPARSE_OVERFLOW,    /**< The number does not fit, the result is clamped to the closest representable value */
+    TPARSE_NO_MEMORY,   /**< The number is too long to convert without allocating and the allocation failed, the result is `0` */
+} TParseStatus;
+
+/**
+ * Parses a decimal integer at the start of `sv`, with an optional `+` or `-` sign.
+ * Unlike `strtoll`, leading whitespace is not skipped and `sv` does not need a null terminator.
+ * Digits are consumed eight at a time where possible.
+ * \code{c}
+ * int64_t value;
+ * size_t consumed;
+ * tsvParseI64(tsvNewFromL("-42,7"), &value, &consumed); // value = -42, consumed = 3
+ * \endcode
+ * \param out        Where the result is stored, `0` if nothing was parsed
+ * \param n_consumed Where the number of bytes which make up the number is stored, may be `NULL`
+ */
+TParseStatus tsvParseI64(TStringView sv, int64_t *out, size_t *n_consumed);
+
+/**
+ * Parses an unsigned decimal integer at the start of `sv`, with an optional `+` sign.
+ * See \ref "tsvParseI64" for the details.
+ */
+TParseStatus tsvParseU64(TStringView sv, uint64_t *out, size_t *n_consumed);
+
+/**
+ * Parses a decimal floating point number at the start of `sv`, rounding it correctly to the nearest double.
+ * Accepts an optional sign, digits with an optional `.`, an optional exponent (`e` or `E`, optionally signed),
+ * as well as `inf`, `infinity` and `nan` in any case. Hexadecimal floats are not supported,
+ * and `.` is the decimal point regardless of the locale.
+ * Most inputs are converted with the Clinger fast path or the Eisel-Lemire algorithm,
+ * only ambiguous inputs with more than 19 significant digits go through `strtod`.
+ * Those are copied to a buffer first, which is only allocated for inputs longer than 127 bytes,
+ * and \ref "TPARSE_NO_MEMORY" is returned if that allocation fails.
+ * \param out        Where the result is stored, `0` if nothing was parsed and infinity on overflow
+ * \param n_consumed Where the number of bytes which make up the number is stored, may be `NULL`
+ */
+TParseStatus tsvParseF64(TStringView sv, double *out, size_t *n_consumed);
+
+/**
+ * A set of bytes in the form the vectorised searches use.
+ */
+typedef struct {
+    uint8_t lo[16];     /**< Bit `h` of `lo[l]` is set if the byte `h << 4 | l` is in the set (`h < 8`) */
+    uint8_t hi[16];     /**< Same as `lo`, for the bytes with the top bit set */
+    uint8_t chars[8];   /**< The members of the set, only valid if `n_chars <= 8` */
+    size_t n_chars;     /**< Number of distinct members */
+} _TCharSet;
+
+/**
+ * The ways a \ref "TSplitIter" splits its input.
+ */
+typedef enum {
+    TSPLIT_DELIMITERS,  /**< Fields between any of the delimiters, empty fields included */
+    TSPLIT_LINES,       /**< Lines ending in `\n` or `\r\n`, a final line terminator does not start another line */
+    TSPLIT_WHITESPACE,  /**< Runs of non-whitespace characters, without empty fields */
+} TSplitKind;
+
+/**
+ * \ref "TSplitIter" yields the parts of a \ref "TStringView" as views into it, without allocating.
+ * Delimiters are located 64 bytes at a time and kept as a bitmask, so a block with many short fields is only scanned once.
+ * \code{c}
+ * TSplitIter it = tsvSplitChar(tsvNewFromL("a,b,,c"), ',');
+ *
+ * TStringView field;
+ * while (tsplitNext(&it, &field)) {
+ *     printf("[%.*s]", (int)field.length, field.data); // => [a][b][][c]
+ * }
+ * \endcode
+ */
+typedef struct {
+    TStringView sv;     /**< The input */
+    size_t pos;         /**< Start of the next part */
+    size_t block;       /**< Offset of the 64 byte block `mask` describes */
+    uint64_t mask;      /**< Delimiters in the block which were not consumed yet, one bit per byte */
+    _TCharSet delims;   /**< The delimiters */
+    TSplitKind kind;    /**< How the parts are formed */
+    bool done;          /**< Whether all parts were returned */
+} TSplitIter;
+
+/**
+ * Splits `sv` at every occurrence of `delim`.
+ * Consecutive delimiters produce empty fields, and so do delimiters at either end. An empty input is a single empty field.
+ */
+TSplitIter tsvSplitChar(TStringView sv, char delim);
+
+/**
+ * Splits `sv` at every occurrence of any of the chars in `delims`, following the same rules as \ref "tsvSplitChar".
+ */
+TSplitIter tsvSplitSet(TStringView sv, TStringView delims);
+
+/**
+ * Splits `sv` into lines, removing the `\n` or `\r\n` at the end of each one.
+ * An empty input has no lines.
+ */
+TSplitIter tsvSplitLines(TStringView sv);
+
+/**
+ * Splits `sv` into words separated by runs of whitespace, as classified by `isspace` in the "C" locale.
+ * Leading and trailing whitespace is ignored.
+ */
+TSplitIter tsvSplitWhitespace(TStringView sv);
+
+/**
+ * Stores the next part in `out`.
+ * \returns `false` if there are no more parts, `out` is not modified in that case
+ */
+bool tsplitNext(TSplitIter *this, TStringView *out);
+
 #endif
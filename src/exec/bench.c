@@ -0,0 +1,77 @@
+// clock_gettime is not part of C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "ctl/alloc.h"
+
+#define BENCH_ITERATIONS 2000000
+#define BENCH_LIVE_OBJECTS 512
+#define BENCH_MAX_THREADS 64
+
+static TDynamicAllocator bench_allocator;
+
+// Replaces random live objects with new ones of 16 to 215 bytes
+static void *benchWorker(void *arg) {
+    void *objects[BENCH_LIVE_OBJECTS] = { 0 };
+    uint32_t state = (uint32_t)(uintptr_t)arg * 2654435761u;
+
+    for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+        state = state * 1103515245u + 12345u;
+
+        void **object = objects + (state >> 8) % BENCH_LIVE_OBJECTS;
+        if (*object) {
+            tdaDealloc(&bench_allocator, *object);
+        }
+
+        size_t n_bytes = 16 + (state >> 16) % 200;
+        *object = tdaAlloc(&bench_allocator, n_bytes);
+        memset(*object, 0, 16);
+    }
+
+    for (size_t i = 0; i < BENCH_LIVE_OBJECTS; ++i) {
+        tdaDealloc(&bench_allocator, objects[i]);
+    }
+
+    if (bench_allocator.alloc == tdaSlab().alloc) {
+        tslabFlushThread();
+    }
+
+    return NULL;
+}
+
+static double benchRun(TDynamicAllocator allocator, size_t n_threads) {
+    bench_allocator = allocator;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t threads[BENCH_MAX_THREADS];
+    for (size_t i = 0; i < n_threads; ++i) {
+        pthread_create(threads + i, NULL, benchWorker, (void *)(uintptr_t)(i + 1));
+    }
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void benchSlab(void) {
+    static const size_t thread_counts[] = { 1, 8, BENCH_MAX_THREADS };
+
+    for (size_t i = 0; i < sizeof thread_counts / sizeof *thread_counts; ++i) {
+        double libc = benchRun(tdaLibc(), thread_counts[i]);
+        double slab = benchRun(tdaSlab(), thread_counts[i]);
+
+        printf("%2zu threads: libc %.3fs, slab %.3fs\n", thread_counts[i], libc, slab);
+    }
+}
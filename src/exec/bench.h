@@ -0,0 +1,7 @@
+#ifndef CTL_EXEC_BENCH_H
+#define CTL_EXEC_BENCH_H
+
+// Compares the slab allocator with libc at 1, 8 and 64 threads and prints the wall times
+void benchSlab(void);
+
+#endif
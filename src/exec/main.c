@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "bench.h"
 #include "ctl/array.h"
 #include "ctl/format.h"
 #include "ctl/hashmap.h"
@@ -23,7 +25,12 @@ static void eraseValue(void *ptr) {
     printf("erasing: %d\n", *(int *)ptr);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "bench-slab") == 0) {
+        benchSlab();
+        return 0;
+    }
+
     I32Array arr = i32NewFilled(37, 23);
     i32Append(&arr, 37);
 
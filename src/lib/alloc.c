@@ -1,3 +1,10 @@
+// mmap flags and madvise are not part of C99
+#define _DEFAULT_SOURCE
+#if defined(__APPLE__)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +12,62 @@
 #include "ctl/alloc.h"
 #include "ctl/def.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#else
+#define HAVE_MMAP 0
+#endif
+
+#if HAVE_MMAP && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// Smallest block a chained arena will allocate
+#define TARENA_MIN_BLOCK 256
+
+// Smallest allocation a chained arena gives a dedicated block instead of growing the chain
+#define TARENA_DEDICATED_MIN ((size_t)64 * 1024)
+
+// Commit granularities of virtual arenas
+#define TARENA_COMMIT_SIZE ((size_t)64 * 1024)
+#define TARENA_HUGE_COMMIT_SIZE ((size_t)2 * 1024 * 1024)
+
+static void *blockData(TArenaBlock *block) {
+    return block + 1;
+}
+
+static TArenaBlock *newBlock(size_t cap, TArenaBlock *prev) {
+    TArenaBlock *block = malloc(sizeof *block + cap);
+    if (!block) {
+        return NULL;
+    }
+
+    block->prev = prev;
+    block->capacity = cap;
+
+    return block;
+}
+
+static void useBlock(TArena *this, TArenaBlock *block) {
+    this->block = block;
+    this->head = blockData(block);
+    this->tail = this->head;
+    this->capacity = block->capacity;
+}
+
+static void updateHighWater(TArena *this) {
+    size_t used = tarenaUsed(this);
+    if (used > this->high_water) {
+        this->high_water = used;
+    }
+}
+
+static size_t alignmentPadding(const TArena *this) {
+    size_t rem = (uintptr_t)this->tail % this->alignment;
+    return rem == 0 ? 0 : this->alignment - rem;
+}
+
 TArena tarenaNew(size_t cap) {
     void *ptr = malloc(cap);
     if (!ptr) {
@@ -17,7 +80,76 @@ TArena tarenaNew(size_t cap) {
         .capacity = cap,
         .cleanup = NULL,
         .alignment = 8,
+        .kind = TARENA_FIXED,
+    };
+}
+
+TArena tarenaNewChained(size_t cap) {
+    if (cap < TARENA_MIN_BLOCK) {
+        cap = TARENA_MIN_BLOCK;
+    }
+
+    TArenaBlock *block = newBlock(cap, NULL);
+    if (!block) {
+        return (TArena) { 0 };
+    }
+
+    TArena this = {
+        .cleanup = NULL,
+        .alignment = 8,
+        .kind = TARENA_CHAINED,
+    };
+
+    useBlock(&this, block);
+
+    return this;
+}
+
+TArena tarenaNewVirtual(size_t reserve, bool huge_pages) {
+#if HAVE_MMAP
+    size_t step = huge_pages ? TARENA_HUGE_COMMIT_SIZE : TARENA_COMMIT_SIZE;
+    if (reserve == 0 || reserve > (size_t)-1 - 2 * step) {
+        return (TArena) { 0 };
+    }
+
+    reserve = (reserve + step - 1) / step * step;
+
+    // Over-reserve so the range can be aligned to the commit granularity
+    size_t mapped = reserve + step;
+    unsigned char *map = mmap(NULL, mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        return (TArena) { 0 };
+    }
+
+    unsigned char *head = (unsigned char *)(((uintptr_t)map + step - 1) & ~(uintptr_t)(step - 1));
+    size_t lead = head - map;
+    if (lead != 0) {
+        munmap(map, lead);
+    }
+
+    if (mapped - lead != reserve) {
+        munmap(head + reserve, mapped - lead - reserve);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(head, reserve, MADV_HUGEPAGE);
+    }
+#endif
+
+    return (TArena) {
+        .head = head,
+        .tail = head,
+        .capacity = 0,
+        .cleanup = NULL,
+        .alignment = 8,
+        .kind = TARENA_VIRTUAL,
+        .reserved = reserve,
+        .commit_size = step,
     };
+#else
+    return (TArena) { 0 };
+#endif
 }
 
 TArena tarenaNewFromBuffer(void *head, size_t cap, TCleanup cleanup) {
@@ -26,11 +158,128 @@ TArena tarenaNewFromBuffer(void *head, size_t cap, TCleanup cleanup) {
         .tail = head,
         .capacity = cap,
         .cleanup = cleanup,
+        .kind = TARENA_FIXED,
     };
 }
 
 void tarenaReset(TArena *this) {
+    if (this->kind == TARENA_CHAINED && this->block) {
+        TArenaBlock *largest = this->block;
+        for (TArenaBlock *block = this->block->prev; block; block = block->prev) {
+            if (block->capacity > largest->capacity) {
+                largest = block;
+            }
+        }
+
+        TArenaBlock *block = this->block;
+        while (block) {
+            TArenaBlock *prev = block->prev;
+            if (block != largest) {
+                free(block);
+            }
+
+            block = prev;
+        }
+
+        largest->prev = NULL;
+        useBlock(this, largest);
+    }
+
+#if HAVE_MMAP
+    if (this->kind == TARENA_VIRTUAL && this->capacity > this->commit_size) {
+        madvise((unsigned char *)this->head + this->commit_size, this->capacity - this->commit_size, MADV_DONTNEED);
+    }
+#endif
+
     this->tail = this->head;
+    this->prev_used = 0;
+}
+
+// Slow path of `tarenaAlloc` for chained arenas
+static void *chainedAlloc(TArena *this, size_t n_bytes) {
+    // Blocks are only aligned for `malloc`, reserve enough for the worst case padding
+    size_t needed = n_bytes + this->alignment;
+    if (needed < n_bytes) {
+        return NULL;
+    }
+
+    size_t cap = this->capacity * 2;
+    if (cap < this->capacity) {
+        cap = needed;
+    }
+
+    if (this->block && needed >= TARENA_DEDICATED_MIN && needed > cap / 2) {
+        // Too large for a regular block, give it a dedicated one behind the current block
+        // so the remaining space in the current block stays usable
+        TArenaBlock *block = newBlock(needed, this->block->prev);
+        if (!block) {
+            return NULL;
+        }
+
+        this->block->prev = block;
+        this->prev_used += needed;
+        updateHighWater(this);
+
+        uintptr_t data = (uintptr_t)blockData(block);
+        size_t rem = data % this->alignment;
+
+        return (unsigned char *)blockData(block) + (rem == 0 ? 0 : this->alignment - rem);
+    }
+
+    // Leave room for more allocations of the same size, so a run of them grows the chain instead of each taking a block
+    if (cap / 2 < needed) {
+        cap = needed <= (size_t)-1 / 2 ? needed * 2 : needed;
+    }
+
+    if (cap < TARENA_MIN_BLOCK) {
+        cap = TARENA_MIN_BLOCK;
+    }
+
+    TArenaBlock *block = newBlock(cap, this->block);
+    if (!block) {
+        return NULL;
+    }
+
+    if (this->block) {
+        this->prev_used += (unsigned char *)this->tail - (unsigned char *)this->head;
+    }
+
+    useBlock(this, block);
+
+    void *ret = (unsigned char *)this->tail + alignmentPadding(this);
+    this->tail = (unsigned char *)ret + n_bytes;
+    updateHighWater(this);
+
+    return ret;
+}
+
+// Slow path of `tarenaAlloc` for virtual arenas
+static void *virtualAlloc(TArena *this, size_t n_bytes, size_t used) {
+#if HAVE_MMAP
+    if (used > this->reserved || n_bytes > this->reserved - used) {
+        return NULL;
+    }
+
+    size_t cap = (used + n_bytes + this->commit_size - 1) / this->commit_size * this->commit_size;
+    if (cap > this->reserved) {
+        cap = this->reserved;
+    }
+
+    unsigned char *start = (unsigned char *)this->head + this->capacity;
+    if (mprotect(start, cap - this->capacity, PROT_READ | PROT_WRITE) != 0) {
+        return NULL;
+    }
+
+    this->capacity = cap;
+
+    void *ret = (unsigned char *)this->head + used;
+    this->tail = (unsigned char *)ret + n_bytes;
+    updateHighWater(this);
+
+    return ret;
+#else
+    return NULL;
+#endif
 }
 
 void *tarenaAlloc(TArena *this, size_t n_bytes) {
@@ -39,19 +288,35 @@ void *tarenaAlloc(TArena *this, size_t n_bytes) {
         this->alignment = 8;
     }
 
-    this->tail = (unsigned char *)this->tail + this->alignment - (uintptr_t)this->tail % this->alignment;
+    size_t padding = alignmentPadding(this);
+    size_t used = (unsigned char *)this->tail - (unsigned char *)this->head + padding;
+    if (used > this->capacity || n_bytes > this->capacity - used) {
+        if (this->kind == TARENA_CHAINED) {
+            return chainedAlloc(this, n_bytes);
+        }
+
+        if (this->kind == TARENA_VIRTUAL) {
+            return virtualAlloc(this, n_bytes, used);
+        }
 
-    size_t used = (unsigned char *)this->tail - (unsigned char *)this->head;
-    if (used + n_bytes > this->capacity) {
         return NULL;
     }
 
-    void *ret = this->tail;
-    this->tail = (unsigned char *)this->tail + n_bytes;
+    void *ret = (unsigned char *)this->tail + padding;
+    this->tail = (unsigned char *)ret + n_bytes;
+
+    size_t total = this->prev_used + used + n_bytes;
+    if (total > this->high_water) {
+        this->high_water = total;
+    }
 
     return ret;
 }
 
+size_t tarenaUsed(const TArena *this) {
+    return this->prev_used + ((unsigned char *)this->tail - (unsigned char *)this->head);
+}
+
 TArena tarenaMove(TArena *this) {
     TArena ret = *this;
     *this = (TArena) { 0 };
@@ -59,7 +324,18 @@ TArena tarenaMove(TArena *this) {
 }
 
 void tarenaFree(TArena *this) {
-    if (this->cleanup) {
+    if (this->kind == TARENA_CHAINED) {
+        TArenaBlock *block = this->block;
+        while (block) {
+            TArenaBlock *prev = block->prev;
+            free(block);
+            block = prev;
+        }
+    } else if (this->kind == TARENA_VIRTUAL) {
+#if HAVE_MMAP
+        munmap(this->head, this->reserved);
+#endif
+    } else if (this->cleanup) {
         this->cleanup(this->head);
     } else {
         free(this->head);
@@ -68,15 +344,103 @@ void tarenaFree(TArena *this) {
     *this = (TArena) { 0 };
 }
 
+TArenaMark tarenaMark(TArena *this) {
+    return (TArenaMark) {
+        .arena = this,
+        .tail = this->tail,
+        .block = this->block,
+        .prev = this->block ? this->block->prev : NULL,
+        .prev_used = this->prev_used,
+    };
+}
+
+void tarenaRewind(TArenaMark mark) {
+    TArena *this = mark.arena;
+    if (!this) {
+        return;
+    }
+
+    if (this->kind == TARENA_CHAINED && mark.block) {
+        // Blocks (and the dedicated blocks inserted behind them) added after the mark
+        TArenaBlock *block = this->block;
+        while (block != mark.block) {
+            TArenaBlock *prev = block->prev;
+            free(block);
+            block = prev;
+        }
+
+        // Dedicated blocks inserted behind the marked block
+        block = mark.block->prev;
+        while (block != mark.prev) {
+            TArenaBlock *prev = block->prev;
+            free(block);
+            block = prev;
+        }
+
+        mark.block->prev = mark.prev;
+
+        if (this->block != mark.block) {
+            useBlock(this, mark.block);
+        }
+    }
+
+    this->tail = mark.tail;
+    this->prev_used = mark.prev_used;
+}
+
+static CTL_THREAD_LOCAL TArena scratch_arenas[TARENA_SCRATCH_COUNT];
+
+TArenaMark tarenaScratchBegin(TArena *const *conflicts, size_t n_conflicts) {
+    for (size_t i = 0; i < TARENA_SCRATCH_COUNT; ++i) {
+        TArena *scratch = scratch_arenas + i;
+
+        bool conflicting = false;
+        for (size_t j = 0; j < n_conflicts; ++j) {
+            if (conflicts[j] == scratch) {
+                conflicting = true;
+                break;
+            }
+        }
+
+        if (conflicting) {
+            continue;
+        }
+
+        if (scratch->kind != TARENA_CHAINED) {
+            *scratch = tarenaNewChained(TARENA_SCRATCH_CAPACITY);
+            if (scratch->kind != TARENA_CHAINED) {
+                break;
+            }
+        }
+
+        return tarenaMark(scratch);
+    }
+
+    return (TArenaMark) { 0 };
+}
+
+void tarenaScratchEnd(TArenaMark scratch) {
+    tarenaRewind(scratch);
+}
+
+void tarenaScratchFree(void) {
+    for (size_t i = 0; i < TARENA_SCRATCH_COUNT; ++i) {
+        tarenaFree(scratch_arenas + i);
+    }
+}
+
 static void *mallocWrapper(size_t n_bytes, void *userdata) {
+    (void)userdata;
     return malloc(n_bytes);
 }
 
 static void *reallocWrapper(void *old, size_t n_bytes, void *userdata) {
+    (void)userdata;
     return realloc(old, n_bytes);
 }
 
 static void freeWrapper(void *ptr, void *userdata) {
+    (void)userdata;
     free(ptr);
 }
 
@@ -87,6 +451,104 @@ TDynamicAllocator tdaLibc(void) {
         .dealloc = freeWrapper,
         .cleanup = NULL,
         .userdata = NULL,
+        .size = NULL,
+    };
+}
+
+// Allocations made through `tdaArena` are prefixed with their size,
+// padded so that the allocation itself stays aligned
+static size_t arenaHeaderSize(const TArena *this) {
+    size_t alignment = this->alignment ? this->alignment : 8;
+    return (sizeof (size_t) + alignment - 1) / alignment * alignment;
+}
+
+static size_t arenaAllocSize(const void *ptr) {
+    size_t n_bytes;
+    memcpy(&n_bytes, (const unsigned char *)ptr - sizeof n_bytes, sizeof n_bytes);
+    return n_bytes;
+}
+
+static void setArenaAllocSize(void *ptr, size_t n_bytes) {
+    memcpy((unsigned char *)ptr - sizeof n_bytes, &n_bytes, sizeof n_bytes);
+}
+
+// Whether `ptr` is the most recent allocation in the current block of `this`
+static bool isArenaTop(const TArena *this, const void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    return p >= (uintptr_t)this->head
+        && p <= (uintptr_t)this->tail
+        && (const unsigned char *)ptr + arenaAllocSize(ptr) == this->tail;
+}
+
+static void *arenaAllocWrapper(size_t n_bytes, void *arena) {
+    size_t header = arenaHeaderSize(arena);
+    if (n_bytes > (size_t)-1 - header) {
+        return NULL;
+    }
+
+    unsigned char *block = tarenaAlloc(arena, header + n_bytes);
+    if (!block) {
+        return NULL;
+    }
+
+    setArenaAllocSize(block + header, n_bytes);
+
+    return block + header;
+}
+
+static void *arenaResizeWrapper(void *old, size_t n_bytes, void *arena) {
+    TArena *this = arena;
+
+    if (!old) {
+        return arenaAllocWrapper(n_bytes, arena);
+    }
+
+    size_t old_bytes = arenaAllocSize(old);
+
+    if (isArenaTop(this, old)) {
+        size_t offset = (unsigned char *)old - (unsigned char *)this->head;
+        if (n_bytes <= this->capacity - offset) {
+            this->tail = (unsigned char *)old + n_bytes;
+            setArenaAllocSize(old, n_bytes);
+            updateHighWater(this);
+            return old;
+        }
+    } else if (n_bytes <= old_bytes) {
+        setArenaAllocSize(old, n_bytes);
+        return old;
+    }
+
+    void *new_block = arenaAllocWrapper(n_bytes, arena);
+    if (!new_block) {
+        return NULL;
+    }
+
+    memcpy(new_block, old, old_bytes < n_bytes ? old_bytes : n_bytes);
+
+    return new_block;
+}
+
+static void arenaDeallocWrapper(void *ptr, void *arena) {
+    TArena *this = arena;
+
+    if (ptr && isArenaTop(this, ptr)) {
+        this->tail = (unsigned char *)ptr - arenaHeaderSize(this);
+    }
+}
+
+static size_t arenaSizeWrapper(const void *ptr, void *arena) {
+    (void)arena;
+    return arenaAllocSize(ptr);
+}
+
+TDynamicAllocator tdaArena(TArena *arena) {
+    return (TDynamicAllocator) {
+        .alloc = arenaAllocWrapper,
+        .resize = arenaResizeWrapper,
+        .dealloc = arenaDeallocWrapper,
+        .cleanup = NULL,
+        .userdata = arena,
+        .size = arenaSizeWrapper,
     };
 }
 
@@ -107,8 +569,23 @@ void *tdaResize(TDynamicAllocator *this, void *old, size_t n_bytes) {
         return this->resize(old, n_bytes, this->userdata);
     }
 
+    if (!old) {
+        return tdaAlloc(this, n_bytes);
+    }
+
+    // The number of bytes to copy can't be known without `size`
+    if (!this->size) {
+        return NULL;
+    }
+
+    size_t old_bytes = this->size(old, this->userdata);
+
     void *new_block = tdaAlloc(this, n_bytes);
-    memcpy(new_block, old, n_bytes);
+    if (!new_block) {
+        return NULL;
+    }
+
+    memcpy(new_block, old, old_bytes < n_bytes ? old_bytes : n_bytes);
 
     tdaDealloc(this, old);
 
@@ -118,3 +595,191 @@ void *tdaResize(TDynamicAllocator *this, void *old, size_t n_bytes) {
 void tdaDealloc(TDynamicAllocator *this, void *ptr) {
     this->dealloc(ptr, this->userdata);
 }
+
+// Default number of objects in a pool slab
+#define TPOOL_SLAB_OBJECTS 256
+
+static TPoolSlab *newSlab(const TPool *this, size_t n_objects) {
+    // `n_objects` comes from the caller of `tpoolReserve`, so the size may not fit
+    if (this->object_size != 0 && n_objects > ((size_t)-1 - sizeof (TPoolSlab)) / this->object_size) {
+        return NULL;
+    }
+
+    TPoolSlab *slab = malloc(sizeof *slab + n_objects * this->object_size);
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->next = NULL;
+    slab->n_objects = n_objects;
+
+    return slab;
+}
+
+static void carveSlab(TPool *this, TPoolSlab *slab) {
+    this->slab = slab;
+    this->cursor = slab + 1;
+    this->end = (unsigned char *)this->cursor + slab->n_objects * this->object_size;
+}
+
+TPool tpoolNew(size_t object_size, size_t slab_objects) {
+    if (object_size < sizeof (void *)) {
+        object_size = sizeof (void *);
+    }
+
+    object_size = (object_size + 7) & ~(size_t)7;
+
+    return (TPool) {
+        .object_size = object_size,
+        .slab_objects = slab_objects ? slab_objects : TPOOL_SLAB_OBJECTS,
+        .free_list = NULL,
+        .cursor = NULL,
+        .end = NULL,
+        .slabs = NULL,
+        .slab = NULL,
+    };
+}
+
+bool tpoolReserve(TPool *this, size_t n) {
+    size_t available = ((unsigned char *)this->end - (unsigned char *)this->cursor) / this->object_size;
+
+    TPoolSlab *last = this->slab;
+    if (last) {
+        for (TPoolSlab *slab = last->next; slab; slab = slab->next) {
+            available += slab->n_objects;
+            last = slab;
+        }
+    }
+
+    if (available >= n) {
+        return true;
+    }
+
+    size_t n_objects = n - available;
+    if (n_objects < this->slab_objects) {
+        n_objects = this->slab_objects;
+    }
+
+    TPoolSlab *slab = newSlab(this, n_objects);
+    if (!slab) {
+        return false;
+    }
+
+    if (last) {
+        last->next = slab;
+    } else {
+        this->slabs = slab;
+        carveSlab(this, slab);
+    }
+
+    return true;
+}
+
+// Slow path of `tpoolAlloc`, moves on to the next slab
+static void *nextSlab(TPool *this) {
+    TPoolSlab *slab = this->slab ? this->slab->next : this->slabs;
+
+    if (!slab) {
+        slab = newSlab(this, this->slab_objects);
+        if (!slab) {
+            return NULL;
+        }
+
+        if (this->slab) {
+            this->slab->next = slab;
+        } else {
+            this->slabs = slab;
+        }
+    }
+
+    carveSlab(this, slab);
+
+    void *obj = this->cursor;
+    this->cursor = (unsigned char *)obj + this->object_size;
+
+    return obj;
+}
+
+void *tpoolAlloc(TPool *this) {
+    void *obj = this->free_list;
+    if (obj) {
+        this->free_list = *(void **)obj;
+        return obj;
+    }
+
+    if (this->cursor != this->end) {
+        obj = this->cursor;
+        this->cursor = (unsigned char *)obj + this->object_size;
+        return obj;
+    }
+
+    return nextSlab(this);
+}
+
+void tpoolDealloc(TPool *this, void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    *(void **)ptr = this->free_list;
+    this->free_list = ptr;
+}
+
+void tpoolReset(TPool *this) {
+    this->free_list = NULL;
+
+    if (this->slabs) {
+        carveSlab(this, this->slabs);
+    }
+}
+
+void tpoolFree(TPool *this) {
+    TPoolSlab *slab = this->slabs;
+    while (slab) {
+        TPoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+
+    *this = tpoolNew(this->object_size, this->slab_objects);
+}
+
+static void *poolAllocWrapper(size_t n_bytes, void *pool) {
+    if (n_bytes > ((TPool *)pool)->object_size) {
+        return NULL;
+    }
+
+    return tpoolAlloc(pool);
+}
+
+static void *poolResizeWrapper(void *old, size_t n_bytes, void *pool) {
+    if (!old) {
+        return poolAllocWrapper(n_bytes, pool);
+    }
+
+    if (n_bytes > ((TPool *)pool)->object_size) {
+        return NULL;
+    }
+
+    return old;
+}
+
+static void poolDeallocWrapper(void *ptr, void *pool) {
+    tpoolDealloc(pool, ptr);
+}
+
+static size_t poolSizeWrapper(const void *ptr, void *pool) {
+    (void)ptr;
+    return ((TPool *)pool)->object_size;
+}
+
+TDynamicAllocator tdaPool(TPool *pool) {
+    return (TDynamicAllocator) {
+        .alloc = poolAllocWrapper,
+        .resize = poolResizeWrapper,
+        .dealloc = poolDeallocWrapper,
+        .cleanup = NULL,
+        .userdata = pool,
+        .size = poolSizeWrapper,
+    };
+}
@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ctl/alloc.h"
+#include "ctl/def.h"
+
+// Default size of the sub-blocks reserved by each thread
+#define TCARENA_CHUNK_SIZE ((size_t)64 * 1024)
+
+typedef struct {
+    const TConcurrentArena *arena;
+    uint64_t generation;
+    unsigned char *cursor;
+    unsigned char *end;
+} ChunkCache;
+
+// Generations are unique across all arenas, so a cache can't be mistaken
+// for a sub-block of a new arena that happens to reuse the address of a freed one
+static uint64_t next_generation = 1;
+
+static CTL_THREAD_LOCAL ChunkCache chunk_cache;
+
+static uint64_t newGeneration(void) {
+    return __atomic_fetch_add(&next_generation, 1, __ATOMIC_RELAXED);
+}
+
+TConcurrentArena tcarenaNew(size_t cap) {
+    void *head = malloc(cap);
+    if (!head) {
+        return (TConcurrentArena) { 0 };
+    }
+
+    return (TConcurrentArena) {
+        .head = head,
+        .capacity = cap,
+        .offset = 0,
+        .alignment = 8,
+        .chunk_size = TCARENA_CHUNK_SIZE,
+        .generation = newGeneration(),
+    };
+}
+
+// Reserves up to `n_bytes` but at least `min_bytes` from the shared offset, storing where the reserved part
+// starts in `offset` and its size in `reserved`. The offset is left alone if fewer than `min_bytes` are left,
+// so it never runs past the capacity.
+static bool reserve(TConcurrentArena *this, size_t n_bytes, size_t min_bytes, size_t *offset, size_t *reserved) {
+    size_t current = __atomic_load_n(&this->offset, __ATOMIC_RELAXED);
+    size_t size;
+
+    do {
+        size_t left = this->capacity - current;
+        if (left < min_bytes) {
+            return false;
+        }
+
+        size = n_bytes < left ? n_bytes : left;
+    } while (!__atomic_compare_exchange_n(&this->offset, &current, current + size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    *offset = current;
+    *reserved = size;
+    return true;
+}
+
+void *tcarenaAlloc(TConcurrentArena *this, size_t n_bytes) {
+    // This exists to keep zero-initalised structs valid
+    size_t alignment = this->alignment ? this->alignment : 8;
+
+    size_t rem = n_bytes % alignment;
+    if (rem != 0) {
+        if (n_bytes > (size_t)-1 - alignment) {
+            return NULL;
+        }
+
+        n_bytes += alignment - rem;
+    }
+
+    ChunkCache *cache = &chunk_cache;
+    if (cache->arena == this
+     && cache->generation == this->generation
+     && (size_t)(cache->end - cache->cursor) >= n_bytes) {
+        void *ret = cache->cursor;
+        cache->cursor += n_bytes;
+        return ret;
+    }
+
+    size_t chunk_size = this->chunk_size ? this->chunk_size / alignment * alignment : TCARENA_CHUNK_SIZE;
+    size_t offset;
+    size_t reserved;
+
+    if (n_bytes > chunk_size / 4) {
+        if (!reserve(this, n_bytes, n_bytes, &offset, &reserved)) {
+            return NULL;
+        }
+
+        return (unsigned char *)this->head + offset;
+    }
+
+    if (!reserve(this, chunk_size, n_bytes, &offset, &reserved)) {
+        return NULL;
+    }
+
+    // The new sub-block replaces whatever was left of the previous one
+    *cache = (ChunkCache) {
+        .arena = this,
+        .generation = this->generation,
+        .cursor = (unsigned char *)this->head + offset + n_bytes,
+        .end = (unsigned char *)this->head + offset + reserved,
+    };
+
+    return (unsigned char *)this->head + offset;
+}
+
+size_t tcarenaUsed(const TConcurrentArena *this) {
+    return __atomic_load_n(&this->offset, __ATOMIC_RELAXED);
+}
+
+void tcarenaReset(TConcurrentArena *this) {
+    __atomic_store_n(&this->offset, 0, __ATOMIC_RELAXED);
+    this->generation = newGeneration();
+}
+
+void tcarenaFree(TConcurrentArena *this) {
+    free(this->head);
+    *this = (TConcurrentArena) { 0 };
+}
@@ -11,7 +11,7 @@
 #define fn_cast(T, value) ((T)(uintptr_t)(value))
 
 static THashmap format_specs = {
-    .n_buckets = 0,
+    .capacity = 0,
 };
 
 static int fmtC(TString *out, TStringView prec, va_list args) {
@@ -143,7 +143,7 @@ static int fmtBool(TString *out, TStringView prec, va_list args) {
 }
 
 void tFmtInitialise(void) {
-    if (format_specs.n_buckets != 0) {
+    if (format_specs.capacity != 0) {
         return;
     }
 
@@ -163,7 +163,7 @@ void tFmtInitialise(void) {
 }
 
 void tFmtDeinitialise(void) {
-    if (format_specs.n_buckets == 0) {
+    if (format_specs.capacity == 0) {
         return;
     }
 
@@ -203,7 +203,7 @@ TString tFmt(TStringView fmt, ...) {
 }
 
 TString tFmtV(TStringView fmt, va_list args) {
-    TString out;
+    TString out = tstrNew();
     tFmtWriteV(fmt, args, stringWriter, &out);
 
     return out;
@@ -265,7 +265,7 @@ static int writeChar(char c, TFmtWriter writer, void *userdata) {
 }
 
 int tFmtWriteV(TStringView fmt, va_list args, TFmtWriter writer, void *userdata) {
-    if (format_specs.n_buckets == 0) {
+    if (format_specs.capacity == 0) {
         return 1;
     }
 
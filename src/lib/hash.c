@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "ctl/str.h"
+
+// The constants and the mixing structure follow wyhash (public domain)
+static const uint64_t secret[4] = {
+    0x2D358DCCAA6C78A5, 0x8BB84B93962EACC9,
+    0x4B33A62ED433D4A3, 0x4D5A2DA51DE1AA47,
+};
+
+// Default seed of `tsvHash`, any value works as long as it never changes
+#define DEFAULT_SEED 0x9E3779B97F4A7C15
+
+// Computes the full 128-bit product of `*a` and `*b`, storing the low half in `*a` and the high half in `*b`
+static inline void mul128(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    mul128(&a, &b);
+    return a ^ b;
+}
+
+// Unaligned native endian reads
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static inline uint64_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// Reads 1 to 3 bytes, every byte of the input contributes
+static inline uint64_t read3(const unsigned char *p, size_t n) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+}
+
+uint64_t tsvHashSeeded(TStringView sv, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)sv.data;
+    size_t n = sv.length;
+
+    seed ^= mix(seed ^ secret[0], secret[1]);
+
+    uint64_t a, b;
+    if (n <= 16) {
+        if (n >= 4) {
+            // Two possibly overlapping pairs of 4 byte reads cover every length between 4 and 16
+            size_t shift = (n >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + n - 4) << 32) | read32(p + n - 4 - shift);
+        } else if (n > 0) {
+            a = read3(p, n);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = n;
+
+        if (i > 48) {
+            // Three independent lanes keep the multipliers busy on long inputs
+            uint64_t see1 = seed, see2 = seed;
+
+            do {
+                seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+                see1 = mix(read64(p + 16) ^ secret[2], read64(p + 24) ^ see1);
+                see2 = mix(read64(p + 32) ^ secret[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        // The last 16 bytes, overlapping the previous block if needed
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    mul128(&a, &b);
+
+    return mix(a ^ secret[0] ^ n, b ^ secret[1]);
+}
+
+uint64_t tsvHash(TStringView sv) {
+    return tsvHashSeeded(sv, DEFAULT_SEED);
+}
+
+uint64_t tsvHashFnv1a(TStringView sv) {
+    uint64_t h = 0xCBF29CE484222325;
+
+    for (size_t i = 0; i < sv.length; ++i) {
+        h ^= sv.data[i];
+        h *= 0x100000001B3;
+    }
+
+    return h;
+}
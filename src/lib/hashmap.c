@@ -1,28 +1,374 @@
+// mmap flags are not part of C99
+#define _DEFAULT_SOURCE
+#if defined(__APPLE__)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #include "ctl/hashmap.h"
-#include "ctl/array.h"
 #include "ctl/str.h"
 
-CTL_DECLARE_ARRAY_METHODS_EXT(_THashmapBucket, _THashmapItem, bucket, static)
-CTL_DEFINE_ARRAY_METHODS_EXT(_THashmapBucket, _THashmapItem, bucket, NULL, NULL, static)
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#else
+#define HAVE_MMAP 0
+#endif
+
+#if HAVE_MMAP && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define GROUP_WIDTH _THASHMAP_GROUP_WIDTH
+
+// Tables at least this large are mapped directly, so an old table can be returned to the system piece by piece
+#define TABLE_MAP_MIN ((size_t)1024 * 1024)
+
+// Smallest part of the slots of an old table that is unmapped at once
+#define TABLE_RELEASE_STEP ((size_t)64 * 1024)
+
+// Not suitable for cryptography, but enough to keep the seeds of different maps and runs apart
+static uint64_t randomSeed(const void *salt) {
+    static uint64_t counter = 0;
+
+    uint64_t state[4] = {
+        (uint64_t)time(NULL),
+        (uint64_t)clock(),
+        (uint64_t)(uintptr_t)salt,
+        __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED),
+    };
+
+    return tsvHashSeeded(tsvNewFromBuf((const unsigned char *)state, sizeof state), (uint64_t)(uintptr_t)&counter);
+}
+
+static uint64_t hashKey(const THashmap *this, TStringView key) {
+    return tsvHashSeeded(key, this->seed);
+}
+
+// The slots and control bytes of either the current or the old table of a map
+typedef struct {
+    size_t capacity;
+    uint8_t *ctrl;
+    _THashmapItem *slots;
+} Table;
+
+static Table currentTable(const THashmap *this) {
+    return (Table) {
+        .capacity = this->capacity,
+        .ctrl = this->ctrl,
+        .slots = this->slots,
+    };
+}
+
+static Table oldTable(const THashmap *this) {
+    return (Table) {
+        .capacity = this->old.capacity,
+        .ctrl = this->old.ctrl,
+        .slots = this->old.slots,
+    };
+}
 
-static _THashmapBucket *getBucket(const THashmap *this, TStringView key) {
-    return this->buckets + (tsvHash(key) % this->n_buckets);
+static void setCtrl(Table table, size_t index, uint8_t value) {
+    _thashmapSetCtrl(table.ctrl, table.capacity, index, value);
 }
 
-static _THashmapItem *getItem(const _THashmapBucket *bucket, TStringView key) {
-    _THashmapItem *item = NULL;
-    for (size_t i = 0; i < bucket->length; ++i) {
-        _THashmapItem *entry = bucket->items + i;
+static _THashmapItem *findInTable(Table table, TStringView key, uint64_t hash) {
+    if (table.capacity == 0) {
+        return NULL;
+    }
+
+    uint8_t h2 = _thashmapFragment(hash);
+    _THashmapProbe probe = _thashmapProbeNew(hash, table.capacity);
+
+    for (;;) {
+        const uint8_t *group = table.ctrl + probe.pos;
+
+        for (_THashmapMask match = _thashmapMatch(group, h2); match; match = _thashmapMaskNext(match)) {
+            _THashmapItem *item = table.slots + ((probe.pos + _thashmapMaskFirst(match)) & probe.mask);
+            if (item->hash == hash && tsvEq(tsvNewFromStr(&item->key), key)) {
+                return item;
+            }
+        }
 
-        if (tsvEq(tsvNewFromStr(&entry->key), key)) {
-            item = entry;
-            break;
+        // A key is never placed past an empty slot
+        if (_thashmapMatchEmpty(group)) {
+            return NULL;
         }
+
+        _thashmapProbeNext(&probe);
+    }
+}
+
+static _THashmapItem *findItem(const THashmap *this, TStringView key, uint64_t hash) {
+    _THashmapItem *item = findInTable(currentTable(this), key, hash);
+    if (!item && this->old.length != 0) {
+        item = findInTable(oldTable(this), key, hash);
     }
 
     return item;
 }
 
+static size_t findFree(Table table, uint64_t hash) {
+    return _thashmapFindFree(table.ctrl, table.capacity, hash);
+}
+
+static double maxLoad(const THashmap *this) {
+    // Zero-initialised maps use the default
+    return this->max_load > 0 ? this->max_load : THASHMAP_DEFAULT_MAX_LOAD;
+}
+
+// Maximum number of keys a table with `capacity` slots holds before it grows, leaving at least one empty slot
+static size_t maxLength(const THashmap *this, size_t capacity) {
+    size_t length = (size_t)((double)capacity * maxLoad(this));
+    return length < capacity ? length : capacity - 1;
+}
+
+// Smallest valid capacity which holds `n_keys` keys without growing, `0` on overflow
+static size_t capacityFor(const THashmap *this, size_t n_keys) {
+    size_t capacity = GROUP_WIDTH < 16 ? 16 : GROUP_WIDTH;
+    while (maxLength(this, capacity) < n_keys) {
+        if (capacity > (size_t)-1 / 2) {
+            return 0;
+        }
+
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+static size_t tableBytes(size_t capacity) {
+    return capacity * sizeof(_THashmapItem) + capacity + GROUP_WIDTH;
+}
+
+static bool isMapped(size_t capacity) {
+    return HAVE_MMAP && tableBytes(capacity) >= TABLE_MAP_MIN;
+}
+
+#if HAVE_MMAP
+static size_t releaseStep(void) {
+    static size_t cached = 0;
+
+    size_t step = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (step == 0) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        step = page_size > 0 && (size_t)page_size > TABLE_RELEASE_STEP ? (size_t)page_size : TABLE_RELEASE_STEP;
+        __atomic_store_n(&cached, step, __ATOMIC_RELAXED);
+    }
+
+    return step;
+}
+#endif
+
+// Bytes at the start of a mapped old table which were unmapped once the slots before `next` were moved
+static size_t releasedBytes(size_t next) {
+#if HAVE_MMAP
+    size_t step = releaseStep();
+    return next * sizeof(_THashmapItem) / step * step;
+#else
+    (void)next;
+    return 0;
+#endif
+}
+
+// Allocates the slots and control bytes of a table with `capacity` slots in a single block
+static bool allocTable(Table *table, size_t capacity) {
+    if (capacity == 0 || capacity > ((size_t)-1 - GROUP_WIDTH) / (sizeof(_THashmapItem) + 1)) {
+        return false;
+    }
+
+    _THashmapItem *slots;
+#if HAVE_MMAP
+    if (isMapped(capacity)) {
+        void *map = mmap(NULL, tableBytes(capacity), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        slots = map != MAP_FAILED ? map : NULL;
+    } else
+#endif
+    {
+        slots = malloc(tableBytes(capacity));
+    }
+
+    if (!slots) {
+        return false;
+    }
+
+    *table = (Table) {
+        .capacity = capacity,
+        .ctrl = (uint8_t *)(slots + capacity),
+        .slots = slots,
+    };
+
+    memset(table->ctrl, _THASHMAP_EMPTY, capacity + GROUP_WIDTH);
+
+    return true;
+}
+
+// Deallocates a table, the first `released` bytes of which were unmapped already
+static void freeTable(Table table, size_t released) {
+    if (!isMapped(table.capacity)) {
+        free(table.slots);
+        return;
+    }
+
+#if HAVE_MMAP
+    munmap((unsigned char *)table.slots + released, tableBytes(table.capacity) - released);
+#endif
+}
+
+static void freeOldTable(THashmap *this) {
+    freeTable(oldTable(this), isMapped(this->old.capacity) ? releasedBytes(this->old.next) : 0);
+    this->old = (_THashmapOldTable) { 0 };
+}
+
+// Moves the keys of the next `n_slots` slots of the old table, `(size_t)-1` moves all of them
+static void migrate(THashmap *this, size_t n_slots) {
+    Table old = oldTable(this);
+    Table current = currentTable(this);
+
+    size_t end = n_slots < old.capacity - this->old.next ? this->old.next + n_slots : old.capacity;
+
+    for (size_t i = this->old.next; i < end && this->old.length != 0; ++i) {
+        if (old.ctrl[i] & 0x80) {
+            continue;
+        }
+
+        uint64_t hash = old.slots[i].hash;
+
+        size_t index = findFree(current, hash);
+        if (current.ctrl[index] == _THASHMAP_DELETED) {
+            // The key was counted against `growth_left` already, but the deleted slot was too
+            ++this->growth_left;
+        }
+
+        setCtrl(current, index, _thashmapFragment(hash));
+        current.slots[index] = old.slots[i];
+
+        // Lookups may still probe past this slot
+        setCtrl(old, i, _THASHMAP_DELETED);
+        --this->old.length;
+    }
+
+    if (this->old.length == 0) {
+        freeOldTable(this);
+        return;
+    }
+
+#if HAVE_MMAP
+    // Nothing reads the slots which were moved, only their control bytes are still probed
+    if (isMapped(old.capacity)) {
+        size_t released = releasedBytes(this->old.next);
+        size_t releasing = releasedBytes(end);
+        if (releasing > released) {
+            munmap((unsigned char *)old.slots + released, releasing - released);
+        }
+    }
+#endif
+
+    this->old.next = end;
+}
+
+// Replaces the current slots with `capacity` new slots, either moving every key or keeping the old slots around
+static bool resize(THashmap *this, size_t capacity, bool incremental) {
+    // Only one old table can be kept
+    if (this->old.capacity != 0) {
+        migrate(this, (size_t)-1);
+    }
+
+    Table old = currentTable(this);
+    Table table;
+    if (!allocTable(&table, capacity)) {
+        return false;
+    }
+
+    this->capacity = table.capacity;
+    this->ctrl = table.ctrl;
+    this->slots = table.slots;
+    this->growth_left = maxLength(this, capacity) - this->length;
+
+    if (old.capacity == 0) {
+        return true;
+    }
+
+    this->old = (_THashmapOldTable) {
+        .capacity = old.capacity,
+        .length = this->length,
+        .next = 0,
+        .ctrl = old.ctrl,
+        .slots = old.slots,
+    };
+
+    if (!incremental) {
+        migrate(this, (size_t)-1);
+    }
+
+    return true;
+}
+
+// Makes sure that an empty slot can be filled, dropping the deleted slots or growing the table
+static bool makeRoom(THashmap *this) {
+    if (this->growth_left > 0) {
+        return true;
+    }
+
+    // Finishing a move frees the deleted slots it left behind in the current table
+    if (this->old.capacity != 0) {
+        migrate(this, (size_t)-1);
+        if (this->growth_left > 0) {
+            return true;
+        }
+    }
+
+    size_t capacity = capacityFor(this, this->length + 1);
+    if (capacity == 0) {
+        return false;
+    }
+
+    // Mostly deleted slots, rebuilding at the same size is enough
+    if (capacity < this->capacity) {
+        capacity = this->capacity;
+    } else if (capacity == this->capacity && this->length + 1 > maxLength(this, capacity) / 2) {
+        capacity *= 2;
+    }
+
+    return resize(this, capacity, this->incremental);
+}
+
+static void erase(THashmap *this, _THashmapItem *item) {
+    if (item >= this->old.slots && item < this->old.slots + this->old.capacity) {
+        // The old table is only probed until it is empty, so the slot can always be deleted
+        setCtrl(oldTable(this), (size_t)(item - this->old.slots), _THASHMAP_DELETED);
+        tstrFree(&item->key);
+
+        ++this->growth_left;
+        --this->length;
+
+        if (--this->old.length == 0) {
+            freeOldTable(this);
+        }
+
+        return;
+    }
+
+    Table table = currentTable(this);
+    size_t index = (size_t)(item - table.slots);
+
+    uint8_t ctrl = _thashmapErasedCtrl(table.ctrl, table.capacity, index);
+    if (ctrl == _THASHMAP_EMPTY) {
+        ++this->growth_left;
+    }
+
+    setCtrl(table, index, ctrl);
+
+    tstrFree(&item->key);
+    --this->length;
+}
+
 static void discardData(const THashmap *this, void *data) {
     if (this->item_destructor) {
         this->item_destructor(data);
@@ -31,12 +377,20 @@ static void discardData(const THashmap *this, void *data) {
 
 THashmap tHashmapNew(size_t n_buckets) {
     THashmap this = {
-        .n_buckets = n_buckets,
+        .capacity = 0,
+        .length = 0,
+        .growth_left = 0,
+        .ctrl = NULL,
+        .slots = NULL,
+        .old = { 0 },
+        .max_load = THASHMAP_DEFAULT_MAX_LOAD,
+        .incremental = false,
         .item_destructor = NULL,
     };
 
-    this.buckets = calloc(n_buckets, sizeof *this.buckets);
-    if (!this.buckets) {
+    this.seed = randomSeed(&this);
+
+    if (!resize(&this, capacityFor(&this, n_buckets), false)) {
         return (THashmap) { 0 };
     }
 
@@ -50,32 +404,91 @@ THashmap tHashmapNewCb(size_t n_buckets, TCleanup destructor) {
     return this;
 }
 
+// Number of old slots moved by every `tHashmapSet` during an incremental resize.
+// The current table has room for at least half as many keys as the old one when the move starts,
+// so even with this few, the move finishes long before the current table fills up.
+#define MIGRATE_STEP 16
+
+// Adds a key which is not in the map yet, with a `NULL` value
+static _THashmapItem *insert(THashmap *this, TStringView key, uint64_t hash) {
+    // Reusing a deleted slot is always possible, filling an empty one may need more room first
+    size_t index = 0;
+    bool fits = this->capacity != 0;
+    if (fits) {
+        index = findFree(currentTable(this), hash);
+        fits = this->growth_left > 0 || this->ctrl[index] == _THASHMAP_DELETED;
+    }
+
+    if (!fits) {
+        if (!makeRoom(this)) {
+            return NULL;
+        }
+
+        index = findFree(currentTable(this), hash);
+    }
+
+    TString owned_key = tstrNewFromView(key);
+    if (owned_key.length != key.length) {
+        return NULL;
+    }
+
+    if (this->ctrl[index] == _THASHMAP_EMPTY) {
+        --this->growth_left;
+    }
+
+    setCtrl(currentTable(this), index, _thashmapFragment(hash));
+    this->slots[index] = (_THashmapItem) {
+        .data = NULL,
+        .key = owned_key,
+        .hash = hash,
+    };
+
+    ++this->length;
+    return this->slots + index;
+}
+
+uint64_t tHashmapHash(const THashmap *this, TStringView key) {
+    return hashKey(this, key);
+}
+
 void tHashmapSet(THashmap *this, TStringView key, void *data) {
-    _THashmapBucket *bucket = getBucket(this, key);
-    _THashmapItem *existing = getItem(bucket, key);
+    tHashmapSetHashed(this, key, hashKey(this, key), data);
+}
+
+void tHashmapSetHashed(THashmap *this, TStringView key, uint64_t hash, void *data) {
+    if (this->old.capacity != 0) {
+        migrate(this, MIGRATE_STEP);
+    }
+
+    _THashmapItem *existing = findItem(this, key, hash);
 
     if (existing) {
         discardData(this, existing->data);
         existing->data = data;
 
         if (!data) {
-            tstrFree(&existing->key);
-            _THashmapItem *last = bucketBack(bucket);
-            *existing = *last;
-            bucketPop(bucket);
+            erase(this, existing);
         }
 
         return;
     }
 
-    bucketAppend(bucket, (_THashmapItem) {
-        .data = data,
-        .key = tstrNewFromView(key),
-    });
+    if (!data) {
+        return;
+    }
+
+    _THashmapItem *item = insert(this, key, hash);
+    if (item) {
+        item->data = data;
+    }
 }
 
 void *tHashmapGet(const THashmap *this, TStringView key) {
-    _THashmapItem *item = getItem(getBucket(this, key), key);
+    return tHashmapGetHashed(this, key, hashKey(this, key));
+}
+
+void *tHashmapGetHashed(const THashmap *this, TStringView key, uint64_t hash) {
+    _THashmapItem *item = findItem(this, key, hash);
     if (item) {
         return item->data;
     }
@@ -83,19 +496,100 @@ void *tHashmapGet(const THashmap *this, TStringView key) {
     return item;
 }
 
-void tHashmapFree(THashmap *this) {
-    for (size_t i = 0; i < this->n_buckets; ++i) {
-        _THashmapBucket *bucket = this->buckets + i;
+void **tHashmapEntry(THashmap *this, TStringView key, bool *inserted) {
+    return tHashmapEntryHashed(this, key, hashKey(this, key), inserted);
+}
 
-        for (size_t j = 0; j < bucket->length; ++j) {
-            _THashmapItem *item = bucket->items + j;
+void **tHashmapEntryHashed(THashmap *this, TStringView key, uint64_t hash, bool *inserted) {
+    if (this->old.capacity != 0) {
+        migrate(this, MIGRATE_STEP);
+    }
+
+    _THashmapItem *item = findItem(this, key, hash);
+    *inserted = !item;
 
-            tstrFree(&item->key);
-            discardData(this, item->data);
+    if (!item) {
+        item = insert(this, key, hash);
+        if (!item) {
+            *inserted = false;
+            return NULL;
         }
+    }
+
+    return &item->data;
+}
+
+bool tHashmapReserve(THashmap *this, size_t n_keys) {
+    if (this->old.capacity != 0) {
+        migrate(this, (size_t)-1);
+    }
+
+    if (this->capacity != 0 && maxLength(this, this->capacity) >= n_keys) {
+        return true;
+    }
 
-        bucketFree(bucket);
+    size_t capacity = capacityFor(this, n_keys > this->length ? n_keys : this->length);
+    if (capacity == 0) {
+        return false;
     }
 
-    free(this->buckets);
+    return resize(this, capacity, false);
+}
+
+void tHashmapSetMaxLoad(THashmap *this, double max_load) {
+    if (max_load <= 0) {
+        max_load = THASHMAP_DEFAULT_MAX_LOAD;
+    } else if (max_load < 0.25) {
+        max_load = 0.25;
+    } else if (max_load > 0.9375) {
+        max_load = 0.9375;
+    }
+
+    if (this->old.capacity != 0) {
+        migrate(this, (size_t)-1);
+    }
+
+    size_t used = this->capacity ? maxLength(this, this->capacity) - this->growth_left : 0;
+    this->max_load = max_load;
+
+    if (this->capacity == 0) {
+        return;
+    }
+
+    size_t limit = maxLength(this, this->capacity);
+    if (used <= limit) {
+        this->growth_left = limit - used;
+        return;
+    }
+
+    // Over the new limit, rebuild at the size the new ratio asks for
+    this->growth_left = 0;
+
+    size_t capacity = capacityFor(this, this->length);
+    if (capacity != 0) {
+        resize(this, capacity, false);
+    }
+}
+
+static void freeItems(const THashmap *this, Table table) {
+    for (size_t i = 0; i < table.capacity; ++i) {
+        if (table.ctrl[i] & 0x80) {
+            continue;
+        }
+
+        _THashmapItem *item = table.slots + i;
+
+        tstrFree(&item->key);
+        discardData(this, item->data);
+    }
+}
+
+void tHashmapFree(THashmap *this) {
+    freeItems(this, currentTable(this));
+    freeTable(currentTable(this), 0);
+
+    if (this->old.capacity != 0) {
+        freeItems(this, oldTable(this));
+        freeOldTable(this);
+    }
 }
@@ -0,0 +1,184 @@
+// sched_yield is not part of C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/intern.h"
+#include "spin.h"
+
+#define INITIAL_SLOTS 64
+#define STORAGE_BLOCK_SIZE ((size_t)16 * 1024)
+
+// Readers never write to the tables, all stores happen under the lock and are published with release semantics:
+// a reader which sees a slot also sees the entry behind it, and one which sees a table also sees its slots
+static const _TInternEntry *loadSlot(const _TInternTable *table, size_t i) {
+    return __atomic_load_n(table->slots + i, __ATOMIC_ACQUIRE);
+}
+
+static _TInternTable *loadTable(const TInternPool *this) {
+    return __atomic_load_n(&this->table, __ATOMIC_ACQUIRE);
+}
+
+static void lockPool(TInternPool *this) {
+    spinLock(&this->lock);
+}
+
+static void unlockPool(TInternPool *this) {
+    spinUnlock(&this->lock);
+}
+
+static TAtom atomOf(const _TInternEntry *entry) {
+    return (TAtom) {
+        .id = entry->id,
+        .data = entry->data,
+    };
+}
+
+static _TInternTable *newTable(size_t n_slots) {
+    _TInternTable *table = calloc(1, sizeof *table + n_slots * sizeof *table->slots);
+    if (table) {
+        table->mask = n_slots - 1;
+    }
+
+    return table;
+}
+
+static const _TInternEntry *lookup(const _TInternTable *table, TStringView sv, uint64_t hash) {
+    if (!table) {
+        return NULL;
+    }
+
+    for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+        const _TInternEntry *entry = loadSlot(table, i);
+        if (!entry) {
+            return NULL;
+        }
+
+        if (entry->hash == hash && entry->length == sv.length && memcmp(entry->data, sv.data, sv.length) == 0) {
+            return entry;
+        }
+    }
+}
+
+// Places an entry known to be absent, the caller holds the lock
+static void place(_TInternTable *table, const _TInternEntry *entry) {
+    size_t i = entry->hash & table->mask;
+    while (table->slots[i]) {
+        i = (i + 1) & table->mask;
+    }
+
+    __atomic_store_n(table->slots + i, entry, __ATOMIC_RELEASE);
+}
+
+// Keeps the table at most half full, the caller holds the lock
+static bool reserveSlot(TInternPool *this) {
+    _TInternTable *table = this->table;
+    if (table && ((size_t)this->n_atoms + 1) * 2 <= table->mask + 1) {
+        return true;
+    }
+
+    size_t n_slots = table ? (table->mask + 1) * 2 : INITIAL_SLOTS;
+
+    _TInternTable *grown = newTable(n_slots);
+    if (!grown) {
+        return false;
+    }
+
+    if (table) {
+        for (size_t i = 0; i <= table->mask; ++i) {
+            if (table->slots[i]) {
+                place(grown, table->slots[i]);
+            }
+        }
+
+        // Readers may still be probing the old table
+        table->prev = this->retired;
+        this->retired = table;
+    }
+
+    __atomic_store_n(&this->table, grown, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+TInternPool tinternNew(void) {
+    TArena storage = tarenaNewChained(STORAGE_BLOCK_SIZE);
+    if (storage.kind != TARENA_CHAINED) {
+        return (TInternPool) { 0 };
+    }
+
+    return (TInternPool) {
+        .table = NULL,
+        .retired = NULL,
+        .storage = storage,
+        .n_atoms = 0,
+        .lock = 0,
+    };
+}
+
+TAtom tinternFind(const TInternPool *this, TStringView sv) {
+    const _TInternEntry *entry = lookup(loadTable(this), sv, tsvHash(sv));
+    return entry ? atomOf(entry) : (TAtom) { 0 };
+}
+
+TAtom tinternGet(TInternPool *this, TStringView sv) {
+    uint64_t hash = tsvHash(sv);
+
+    const _TInternEntry *entry = lookup(loadTable(this), sv, hash);
+    if (entry) {
+        return atomOf(entry);
+    }
+
+    lockPool(this);
+
+    // Another thread may have added it in the meantime
+    entry = lookup(this->table, sv, hash);
+    if (entry) {
+        unlockPool(this);
+        return atomOf(entry);
+    }
+
+    if (this->n_atoms == UINT32_MAX || sv.length > (size_t)-1 - sizeof (_TInternEntry) - 1 || !reserveSlot(this)) {
+        unlockPool(this);
+        return (TAtom) { 0 };
+    }
+
+    _TInternEntry *created = tarenaAlloc(&this->storage, sizeof (_TInternEntry) + sv.length + 1);
+    if (!created) {
+        unlockPool(this);
+        return (TAtom) { 0 };
+    }
+
+    created->hash = hash;
+    created->length = sv.length;
+    created->id = this->n_atoms + 1;
+    memcpy(created->data, sv.data, sv.length);
+    created->data[sv.length] = '\0';
+
+    place(this->table, created);
+    __atomic_store_n(&this->n_atoms, created->id, __ATOMIC_RELAXED);
+
+    unlockPool(this);
+
+    return atomOf(created);
+}
+
+size_t tinternCount(const TInternPool *this) {
+    return __atomic_load_n(&this->n_atoms, __ATOMIC_RELAXED);
+}
+
+void tinternFree(TInternPool *this) {
+    _TInternTable *table = this->retired;
+    while (table) {
+        _TInternTable *prev = table->prev;
+        free(table);
+        table = prev;
+    }
+
+    free(this->table);
+    tarenaFree(&this->storage);
+
+    *this = (TInternPool) { 0 };
+}
@@ -0,0 +1,348 @@
+// mmap, madvise and read are not part of C99
+#define _DEFAULT_SOURCE
+#if defined(__APPLE__)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/io.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_POSIX_IO 1
+#else
+#define HAVE_POSIX_IO 0
+#endif
+
+// File views
+#if HAVE_POSIX_IO
+static void advise(void *addr, size_t length, TFileViewAccess access) {
+    int advice;
+    switch (access) {
+    case TFVIEW_SEQUENTIAL:
+#ifdef MADV_SEQUENTIAL
+        advice = MADV_SEQUENTIAL;
+        break;
+#else
+        return;
+#endif
+    case TFVIEW_RANDOM:
+#ifdef MADV_RANDOM
+        advice = MADV_RANDOM;
+        break;
+#else
+        return;
+#endif
+    default:
+        return;
+    }
+
+    // Only a hint, failing is harmless
+    madvise(addr, length, advice);
+}
+
+bool tfviewOpen(TFileView *this, const char *path, TFileViewAccess access) {
+    *this = (TFileView) { 0 };
+
+    int flags = O_RDONLY;
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+
+    int fd = open(path, flags);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || (uintmax_t)info.st_size > SIZE_MAX) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)info.st_size;
+    if (length == 0) {
+        // Empty mappings are not allowed
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    advise(data, length, access);
+
+    *this = (TFileView) {
+        .data = data,
+        .length = length,
+        .mapped = true,
+    };
+
+    return true;
+}
+#else
+bool tfviewOpen(TFileView *this, const char *path, TFileViewAccess access) {
+    (void)access;
+    *this = (TFileView) { 0 };
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    if (size == 0) {
+        fclose(file);
+        return true;
+    }
+
+    void *data = malloc((size_t)size);
+    if (!data || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+
+    *this = (TFileView) {
+        .data = data,
+        .length = (size_t)size,
+        .mapped = false,
+    };
+
+    return true;
+}
+#endif
+
+TStringView tfviewGet(const TFileView *this) {
+    return tsvNewFromBuf(this->data, this->length);
+}
+
+void tfviewPrefetch(const TFileView *this, size_t offset, size_t length) {
+#if HAVE_POSIX_IO && defined(MADV_WILLNEED)
+    if (!this->mapped || offset >= this->length) {
+        return;
+    }
+
+    if (length > this->length - offset) {
+        length = this->length - offset;
+    }
+
+    // madvise wants a page aligned address
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t misalignment = page_size > 0 ? offset % (size_t)page_size : 0;
+
+    madvise((char *)this->data + offset - misalignment, length + misalignment, MADV_WILLNEED);
+#else
+    (void)this;
+    (void)offset;
+    (void)length;
+#endif
+}
+
+void tfviewFree(TFileView *this) {
+    if (this->mapped) {
+#if HAVE_POSIX_IO
+        munmap(this->data, this->length);
+#endif
+    } else {
+        free(this->data);
+    }
+
+    *this = (TFileView) { 0 };
+}
+
+// Record readers
+TRecordReader treaderNew(int fd, size_t buffer_size) {
+    return treaderNewWithAllocator(fd, buffer_size, NULL);
+}
+
+TRecordReader treaderNewWithAllocator(int fd, size_t buffer_size, TDynamicAllocator *allocator) {
+    return (TRecordReader) {
+        .buffer = NULL,
+        .capacity = buffer_size ? buffer_size : TREADER_BUFFER_SIZE,
+        .start = 0,
+        .end = 0,
+        .scanned = 0,
+        .fd = fd,
+        .eof = false,
+        .failed = false,
+        .allocator = allocator,
+    };
+}
+
+static char *resizeBuffer(TRecordReader *this, char *old, size_t n_bytes) {
+    if (this->allocator) {
+        return tdaResize(this->allocator, old, n_bytes);
+    }
+
+    return realloc(old, n_bytes);
+}
+
+// Makes room at the end of the buffer, moving the unread data to the front or growing the buffer if it is full
+static bool makeRoom(TRecordReader *this) {
+    if (!this->buffer) {
+        this->buffer = resizeBuffer(this, NULL, this->capacity);
+        return this->buffer != NULL;
+    }
+
+    if (this->start == this->end) {
+        this->start = this->end = this->scanned = 0;
+        return true;
+    }
+
+    if (this->end < this->capacity) {
+        return true;
+    }
+
+    if (this->start > 0) {
+        size_t unread = this->end - this->start;
+        memmove(this->buffer, this->buffer + this->start, unread);
+
+        this->scanned -= this->start;
+        this->end = unread;
+        this->start = 0;
+        return true;
+    }
+
+    // A single record fills the whole buffer
+    if (this->capacity > (size_t)-1 / 2) {
+        return false;
+    }
+
+    char *buffer = resizeBuffer(this, this->buffer, this->capacity * 2);
+    if (!buffer) {
+        return false;
+    }
+
+    this->buffer = buffer;
+    this->capacity *= 2;
+    return true;
+}
+
+// Reads more data into the buffer, returns `false` at the end of the input or on failure
+static bool fill(TRecordReader *this) {
+    if (this->eof || this->failed) {
+        return false;
+    }
+
+    if (!makeRoom(this)) {
+        this->failed = true;
+        return false;
+    }
+
+#if HAVE_POSIX_IO
+    for (;;) {
+        ssize_t n_read = read(this->fd, this->buffer + this->end, this->capacity - this->end);
+        if (n_read > 0) {
+            this->end += (size_t)n_read;
+            return true;
+        }
+
+        if (n_read == 0) {
+            this->eof = true;
+            return false;
+        }
+
+        if (errno != EINTR) {
+            this->failed = true;
+            return false;
+        }
+    }
+#else
+    this->failed = true;
+    return false;
+#endif
+}
+
+// Like `treaderNext`, also reports whether the record was terminated by `delim`
+static bool nextRecord(TRecordReader *this, char delim, TStringView *out, bool *terminated) {
+    for (;;) {
+        if (this->buffer) {
+            // Only the data which arrived since the last search has to be searched
+            const char *found = memchr(this->buffer + this->scanned, delim, this->end - this->scanned);
+            if (found) {
+                size_t end = (size_t)(found - this->buffer);
+
+                *out = tsvNewFromBuf((const unsigned char *)this->buffer + this->start, end - this->start);
+                *terminated = true;
+
+                this->start = this->scanned = end + 1;
+                return true;
+            }
+
+            this->scanned = this->end;
+        }
+
+        if (!fill(this)) {
+            break;
+        }
+    }
+
+    if (this->failed || this->start == this->end) {
+        return false;
+    }
+
+    *out = tsvNewFromBuf((const unsigned char *)this->buffer + this->start, this->end - this->start);
+    *terminated = false;
+
+    this->start = this->scanned = this->end;
+    return true;
+}
+
+bool treaderNext(TRecordReader *this, char delim, TStringView *out) {
+    bool terminated;
+    return nextRecord(this, delim, out, &terminated);
+}
+
+bool treaderNextLine(TRecordReader *this, TStringView *out) {
+    bool terminated;
+    if (!nextRecord(this, '\n', out, &terminated)) {
+        return false;
+    }
+
+    if (terminated && out->length > 0 && out->data[out->length - 1] == '\r') {
+        --out->length;
+    }
+
+    return true;
+}
+
+bool treaderFailed(const TRecordReader *this) {
+    return this->failed;
+}
+
+void treaderFree(TRecordReader *this) {
+    if (!this->buffer) {
+        // Nothing to deallocate
+    } else if (this->allocator) {
+        tdaDealloc(this->allocator, this->buffer);
+    } else {
+        free(this->buffer);
+    }
+
+    *this = treaderNewWithAllocator(this->fd, this->capacity, this->allocator);
+}
@@ -0,0 +1,503 @@
+#include <float.h>
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/str.h"
+#include "pow5.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR 1
+#else
+#define HAVE_SWAR 0
+#endif
+
+// Significant decimal digits which always fit in a `uint64_t`
+#define MAX_DIGITS 19
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+#if HAVE_SWAR
+static uint64_t load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static bool isEightDigits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333);
+}
+
+// Converts eight ASCII digits, the first one in the lowest byte, with three multiplications
+static uint32_t parseEightDigits(uint64_t v) {
+    v = (v & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+    v = (v & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+    return (uint32_t)((v & 0x0000FFFF0000FFFF) * 42949672960001 >> 32);
+}
+#endif
+
+// Accumulates digits into `*value` while it stays below `MAX_DIGITS` digits, `*n_digits` counts them.
+// Returns the position after the last digit consumed.
+static const char *accumulate(const char *p, const char *end, uint64_t *value, size_t *n_digits) {
+    uint64_t v = *value;
+    size_t n = *n_digits;
+
+#if HAVE_SWAR
+    while (end - p >= 8 && n + 8 <= MAX_DIGITS) {
+        uint64_t chunk = load64(p);
+        if (!isEightDigits(chunk)) {
+            break;
+        }
+
+        v = v * 100000000 + parseEightDigits(chunk);
+        n += 8;
+        p += 8;
+    }
+#endif
+
+    while (p < end && n < MAX_DIGITS && isDigit(*p)) {
+        v = v * 10 + (uint64_t)(*p - '0');
+        ++n;
+        ++p;
+    }
+
+    *value = v;
+    *n_digits = n;
+
+    return p;
+}
+
+static const char *skipZeros(const char *p, const char *end) {
+    while (p < end && *p == '0') {
+        ++p;
+    }
+
+    return p;
+}
+
+// Parses an unsigned decimal magnitude, saturating at `UINT64_MAX`
+static const char *parseMagnitude(const char *p, const char *end, uint64_t *out, bool *overflow) {
+    p = skipZeros(p, end);
+
+    uint64_t value = 0;
+    size_t n_digits = 0;
+    p = accumulate(p, end, &value, &n_digits);
+
+    *overflow = false;
+
+    // Only the 20th digit can still fit
+    for (; p < end && isDigit(*p); ++p) {
+        uint64_t digit = (uint64_t)(*p - '0');
+
+        if (*overflow || value > (UINT64_MAX - digit) / 10) {
+            *overflow = true;
+            continue;
+        }
+
+        value = value * 10 + digit;
+    }
+
+    *out = *overflow ? UINT64_MAX : value;
+
+    return p;
+}
+
+static void setConsumed(size_t *n_consumed, size_t n) {
+    if (n_consumed) {
+        *n_consumed = n;
+    }
+}
+
+TParseStatus tsvParseU64(TStringView sv, uint64_t *out, size_t *n_consumed) {
+    const char *p = sv.data;
+    const char *end = sv.data + sv.length;
+
+    if (p < end && *p == '+') {
+        ++p;
+    }
+
+    if (p == end || !isDigit(*p)) {
+        *out = 0;
+        setConsumed(n_consumed, 0);
+        return TPARSE_INVALID;
+    }
+
+    bool overflow;
+    p = parseMagnitude(p, end, out, &overflow);
+
+    setConsumed(n_consumed, (size_t)(p - sv.data));
+
+    return overflow ? TPARSE_OVERFLOW : TPARSE_OK;
+}
+
+TParseStatus tsvParseI64(TStringView sv, int64_t *out, size_t *n_consumed) {
+    const char *p = sv.data;
+    const char *end = sv.data + sv.length;
+
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    if (p == end || !isDigit(*p)) {
+        *out = 0;
+        setConsumed(n_consumed, 0);
+        return TPARSE_INVALID;
+    }
+
+    uint64_t magnitude;
+    bool overflow;
+    p = parseMagnitude(p, end, &magnitude, &overflow);
+
+    setConsumed(n_consumed, (size_t)(p - sv.data));
+
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+    if (overflow || magnitude > limit) {
+        *out = negative ? INT64_MIN : INT64_MAX;
+        return TPARSE_OVERFLOW;
+    }
+
+    // Negating in unsigned arithmetic keeps INT64_MIN well defined
+    *out = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+
+    return TPARSE_OK;
+}
+
+// Floating point
+
+#define MANTISSA_BITS 52
+#define INFINITE_POWER 0x7FF
+
+static double composeDouble(bool negative, uint64_t mantissa, int32_t power2) {
+    uint64_t bits = mantissa | (uint64_t)power2 << MANTISSA_BITS | (uint64_t)negative << 63;
+
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    return d;
+}
+
+static void mul128(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    *lo = t + (rm1 << 32);
+    c += *lo < t;
+    *hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static int leadingZeros(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(n);
+#else
+    int i = 0;
+    while (!(n & ((uint64_t)1 << 63))) {
+        n <<= 1;
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+// Eisel-Lemire: converts `w * 10^q` to the nearest double (`w != 0`) using the 128-bit approximation of 5^q,
+// which is always precise enough (Mushtak & Lemire, "Fast Number Parsing Without Fallback").
+// Stores the biased binary exponent in `power2` and the fraction bits in `mantissa`.
+static void eiselLemire(uint64_t w, int64_t q, uint64_t *mantissa, int32_t *power2) {
+    if (q < POW5_MIN_EXPONENT) {
+        *mantissa = 0;
+        *power2 = 0;
+        return;
+    }
+
+    if (q > POW5_MAX_EXPONENT) {
+        *mantissa = 0;
+        *power2 = INFINITE_POWER;
+        return;
+    }
+
+    int lz = leadingZeros(w);
+    w <<= lz;
+
+    size_t index = 2 * (size_t)(q - POW5_MIN_EXPONENT);
+
+    uint64_t hi, lo;
+    mul128(w, pow5_128[index], &hi, &lo);
+
+    // The low half of the power only matters if the bits below the result's precision are all ones
+    const uint64_t precision_mask = UINT64_MAX >> (MANTISSA_BITS + 3);
+    if ((hi & precision_mask) == precision_mask) {
+        uint64_t hi2, lo2;
+        mul128(w, pow5_128[index + 1], &hi2, &lo2);
+
+        lo += hi2;
+        if (hi2 > lo) {
+            ++hi;
+        }
+    }
+
+    int upper_bit = (int)(hi >> 63);
+    int shift = upper_bit + 64 - MANTISSA_BITS - 3;
+
+    uint64_t m = hi >> shift;
+    // floor(log2(10^q)) + 63, plus the bias
+    int32_t p2 = (int32_t)((((152170 + 65536) * q) >> 16) + 63 + upper_bit - lz + 1023);
+
+    if (p2 <= 0) {
+        // Subnormal, or zero if it is too small even for that
+        if (-p2 + 1 >= 64) {
+            *mantissa = 0;
+            *power2 = 0;
+            return;
+        }
+
+        m >>= -p2 + 1;
+        m += m & 1;
+        m >>= 1;
+
+        *mantissa = m;
+        *power2 = m < ((uint64_t)1 << MANTISSA_BITS) ? 0 : 1;
+        return;
+    }
+
+    // Exactly halfway between two doubles, round to even instead of up.
+    // This can only happen when 5^q fits in 64 bits.
+    if (lo <= 1 && q >= -4 && q <= 23 && (m & 3) == 1 && (m << shift) == hi) {
+        m &= ~(uint64_t)1;
+    }
+
+    m += m & 1;
+    m >>= 1;
+
+    if (m >= (uint64_t)2 << MANTISSA_BITS) {
+        m = (uint64_t)1 << MANTISSA_BITS;
+        ++p2;
+    }
+
+    m &= ~((uint64_t)1 << MANTISSA_BITS);
+
+    if (p2 >= INFINITE_POWER) {
+        m = 0;
+        p2 = INFINITE_POWER;
+    }
+
+    *mantissa = m;
+    *power2 = p2;
+}
+
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Slow path for mantissas with more than `MAX_DIGITS` significant digits, which are rare.
+// strtod expects the decimal point of the current locale, so the text is copied with that one in place of '.'.
+// Returns `false` if the copy does not fit on the stack and can't be allocated.
+static bool parseWithLibc(const char *start, size_t length, double *out) {
+    const char *point = localeconv()->decimal_point;
+    size_t point_length = strlen(point);
+
+    char small[128];
+    size_t capacity = length * point_length + 1;
+    char *buf = capacity <= sizeof small ? small : malloc(capacity);
+    if (!buf) {
+        *out = 0.0;
+        return false;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if (start[i] == '.') {
+            memcpy(buf + n, point, point_length);
+            n += point_length;
+        } else {
+            buf[n++] = start[i];
+        }
+    }
+
+    buf[n] = '\0';
+
+    *out = strtod(buf, NULL);
+
+    if (buf != small) {
+        free(buf);
+    }
+
+    return true;
+}
+
+// Matches `word` case insensitively at `p`
+static bool matchWord(const char *p, const char *end, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n) {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if ((p[i] | 0x20) != word[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static const char *parseSpecial(const char *p, const char *end, bool negative, double *out) {
+    if (matchWord(p, end, "infinity")) {
+        *out = negative ? -HUGE_VAL : HUGE_VAL;
+        return p + 8;
+    }
+
+    if (matchWord(p, end, "inf")) {
+        *out = negative ? -HUGE_VAL : HUGE_VAL;
+        return p + 3;
+    }
+
+    if (matchWord(p, end, "nan")) {
+        *out = negative ? -NAN : NAN;
+        return p + 3;
+    }
+
+    return NULL;
+}
+
+TParseStatus tsvParseF64(TStringView sv, double *out, size_t *n_consumed) {
+    const char *start = sv.data;
+    const char *end = sv.data + sv.length;
+    const char *p = start;
+
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    const char *special = p < end ? parseSpecial(p, end, negative, out) : NULL;
+    if (special) {
+        setConsumed(n_consumed, (size_t)(special - start));
+        return TPARSE_OK;
+    }
+
+    uint64_t w = 0;
+    size_t n_digits = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    bool any_digits = false;
+
+    // Integer part, digits past `MAX_DIGITS` only scale the value
+    const char *digits = p;
+    p = skipZeros(p, end);
+    p = accumulate(p, end, &w, &n_digits);
+    for (; p < end && isDigit(*p); ++p) {
+        ++exponent;
+        truncated |= *p != '0';
+    }
+
+    any_digits = p != digits;
+
+    if (p < end && *p == '.') {
+        ++p;
+
+        const char *fraction = p;
+        if (n_digits == 0) {
+            // Leading zeros of the fraction are not significant either
+            p = skipZeros(p, end);
+            exponent -= p - fraction;
+        }
+
+        const char *before = p;
+        p = accumulate(p, end, &w, &n_digits);
+        exponent -= p - before;
+
+        for (; p < end && isDigit(*p); ++p) {
+            truncated |= *p != '0';
+        }
+
+        any_digits |= p != fraction;
+    }
+
+    if (!any_digits) {
+        *out = 0.0;
+        setConsumed(n_consumed, 0);
+        return TPARSE_INVALID;
+    }
+
+    // The exponent is only consumed if it has digits
+    if (p < end && (*p | 0x20) == 'e') {
+        const char *e = p + 1;
+
+        bool negative_exponent = false;
+        if (e < end && (*e == '+' || *e == '-')) {
+            negative_exponent = *e == '-';
+            ++e;
+        }
+
+        if (e < end && isDigit(*e)) {
+            int64_t value = 0;
+            for (; e < end && isDigit(*e); ++e) {
+                // Anything this large is zero or infinity anyway
+                if (value < 100000) {
+                    value = value * 10 + (*e - '0');
+                }
+            }
+
+            exponent += negative_exponent ? -value : value;
+            p = e;
+        }
+    }
+
+    setConsumed(n_consumed, (size_t)(p - start));
+
+    if (w == 0) {
+        *out = negative ? -0.0 : 0.0;
+        return TPARSE_OK;
+    }
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    // Clinger's fast path: both operands are exact, so is the correctly rounded result
+    if (!truncated && w <= (uint64_t)1 << 53 && exponent >= -22 && exponent <= 22) {
+        double d = (double)w;
+        d = exponent < 0 ? d / exact_powers[-exponent] : d * exact_powers[exponent];
+
+        *out = negative ? -d : d;
+        return TPARSE_OK;
+    }
+#else
+    (void)exact_powers;
+#endif
+
+    uint64_t mantissa;
+    int32_t power2;
+    eiselLemire(w, exponent, &mantissa, &power2);
+
+    if (truncated) {
+        // The true value lies between `w` and `w + 1`, only a tie between those needs the slow path
+        uint64_t mantissa_up;
+        int32_t power2_up;
+        eiselLemire(w + 1, exponent, &mantissa_up, &power2_up);
+
+        if (mantissa != mantissa_up || power2 != power2_up) {
+            if (!parseWithLibc(start, (size_t)(p - start), out)) {
+                return TPARSE_NO_MEMORY;
+            }
+
+            return *out == HUGE_VAL || *out == -HUGE_VAL ? TPARSE_OVERFLOW : TPARSE_OK;
+        }
+    }
+
+    *out = composeDouble(negative, mantissa, power2);
+
+    return power2 == INFINITE_POWER ? TPARSE_OVERFLOW : TPARSE_OK;
+}
@@ -0,0 +1,353 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/rope.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <sys/uio.h>
+#define HAVE_WRITEV 1
+#else
+#define HAVE_WRITEV 0
+#endif
+
+// Capacity of a regular segment, so that it takes `TROPE_SEGMENT_SIZE` bytes with its header
+#define DEFAULT_CAPACITY (TROPE_SEGMENT_SIZE - sizeof (TRopeSegment))
+
+// Number of segments passed to a single `writev` call, well below any `IOV_MAX`
+#define WRITEV_BATCH 256
+
+static size_t minSize(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+static void *allocate(TRope *this, size_t n_bytes) {
+    if (this->allocator) {
+        return tdaAlloc(this->allocator, n_bytes);
+    }
+
+    return malloc(n_bytes);
+}
+
+static void deallocate(TRope *this, void *ptr) {
+    if (this->allocator) {
+        tdaDealloc(this->allocator, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+static TRopeSegment *newSegment(TRope *this, size_t min_capacity) {
+    size_t capacity = min_capacity > DEFAULT_CAPACITY ? min_capacity : DEFAULT_CAPACITY;
+    if (capacity > (size_t)-1 - sizeof (TRopeSegment)) {
+        return NULL;
+    }
+
+    TRopeSegment *segment = allocate(this, sizeof *segment + capacity);
+    if (!segment) {
+        return NULL;
+    }
+
+    *segment = (TRopeSegment) {
+        .prev = NULL,
+        .next = NULL,
+        .start = 0,
+        .length = 0,
+        .capacity = capacity,
+    };
+
+    return segment;
+}
+
+static size_t backRoom(const TRopeSegment *segment) {
+    return segment->capacity - segment->start - segment->length;
+}
+
+// Links `segment` between `after` and the segment following it (the first segment if `after` is `NULL`)
+static void linkAfter(TRope *this, TRopeSegment *after, TRopeSegment *segment) {
+    TRopeSegment *before = after ? after->next : this->head;
+
+    segment->prev = after;
+    segment->next = before;
+
+    if (after) {
+        after->next = segment;
+    } else {
+        this->head = segment;
+    }
+
+    if (before) {
+        before->prev = segment;
+    } else {
+        this->tail = segment;
+    }
+}
+
+// Places `sv` between `after` and the segment following it.
+// The free space at the end of `after` and at the start of the following segment is used first,
+// whatever is left goes into a single new segment.
+static bool insertBetween(TRope *this, TRopeSegment *after, TStringView sv) {
+    TRopeSegment *before = after ? after->next : this->head;
+
+    size_t front = after ? minSize(backRoom(after), sv.length) : 0;
+    size_t back = before ? minSize(before->start, sv.length - front) : 0;
+    size_t middle = sv.length - front - back;
+
+    TRopeSegment *segment = NULL;
+    if (middle > 0) {
+        segment = newSegment(this, middle);
+        if (!segment) {
+            return false;
+        }
+    }
+
+    if (front > 0) {
+        memcpy(after->data + after->start + after->length, sv.data, front);
+        after->length += front;
+    }
+
+    if (back > 0) {
+        before->start -= back;
+        before->length += back;
+        memcpy(before->data + before->start, sv.data + sv.length - back, back);
+    }
+
+    if (segment) {
+        // A segment created by prepending keeps its free space in front, for the next prepend to fill
+        segment->start = after ? 0 : segment->capacity - middle;
+        segment->length = middle;
+        memcpy(segment->data + segment->start, sv.data + front, middle);
+
+        linkAfter(this, after, segment);
+    }
+
+    this->length += sv.length;
+
+    return true;
+}
+
+// Finds the segment holding the character at `index`, which must be in bounds
+static TRopeSegment *locate(const TRope *this, size_t index, size_t *offset) {
+    if (index < this->length / 2) {
+        TRopeSegment *segment = this->head;
+        while (index >= segment->length) {
+            index -= segment->length;
+            segment = segment->next;
+        }
+
+        *offset = index;
+        return segment;
+    }
+
+    size_t from_end = this->length - index;
+
+    TRopeSegment *segment = this->tail;
+    while (from_end > segment->length) {
+        from_end -= segment->length;
+        segment = segment->prev;
+    }
+
+    *offset = segment->length - from_end;
+    return segment;
+}
+
+TRope tropeNew(void) {
+    return tropeNewWithAllocator(NULL);
+}
+
+TRope tropeNewWithAllocator(TDynamicAllocator *allocator) {
+    return (TRope) {
+        .head = NULL,
+        .tail = NULL,
+        .length = 0,
+        .allocator = allocator,
+    };
+}
+
+bool tropeAppend(TRope *this, TStringView sv) {
+    return insertBetween(this, this->tail, sv);
+}
+
+bool tropePrepend(TRope *this, TStringView sv) {
+    return insertBetween(this, NULL, sv);
+}
+
+bool tropeInsert(TRope *this, size_t index, TStringView sv) {
+    if (index > this->length) {
+        return false;
+    }
+
+    if (index == this->length) {
+        return tropeAppend(this, sv);
+    }
+
+    size_t offset;
+    TRopeSegment *segment = locate(this, index, &offset);
+
+    if (offset == 0) {
+        return insertBetween(this, segment->prev, sv);
+    }
+
+    char *chars = segment->data + segment->start;
+    size_t n = sv.length;
+
+    // Make room inside the segment if it has enough free space, moving the shorter side
+    bool fits_back = backRoom(segment) >= n;
+    bool fits_front = segment->start >= n;
+
+    if (fits_front && (!fits_back || offset < segment->length - offset)) {
+        memmove(chars - n, chars, offset);
+        memcpy(chars - n + offset, sv.data, n);
+
+        segment->start -= n;
+        segment->length += n;
+        this->length += n;
+
+        return true;
+    }
+
+    if (fits_back) {
+        memmove(chars + offset + n, chars + offset, segment->length - offset);
+        memcpy(chars + offset, sv.data, n);
+
+        segment->length += n;
+        this->length += n;
+
+        return true;
+    }
+
+    // Split the segment at `offset`, and insert between the two halves
+    size_t rest_length = segment->length - offset;
+
+    TRopeSegment *rest = newSegment(this, rest_length);
+    if (!rest) {
+        return false;
+    }
+
+    memcpy(rest->data, chars + offset, rest_length);
+    rest->length = rest_length;
+    segment->length = offset;
+
+    linkAfter(this, segment, rest);
+
+    return insertBetween(this, segment, sv);
+}
+
+TRopeIter tropeIter(const TRope *this) {
+    return (TRopeIter) {
+        .segment = this->head,
+    };
+}
+
+bool tropeIterNext(TRopeIter *this, TStringView *out) {
+    while (this->segment && this->segment->length == 0) {
+        this->segment = this->segment->next;
+    }
+
+    if (!this->segment) {
+        return false;
+    }
+
+    *out = tsvNewFromBuf((const unsigned char *)this->segment->data + this->segment->start, this->segment->length);
+    this->segment = this->segment->next;
+
+    return true;
+}
+
+TString tropeFlatten(const TRope *this) {
+    TString out = tstrNewWithAllocator(this->allocator);
+
+    tstrReserve(&out, this->length + 1); // +1 for the null terminator
+    if (out.capacity < this->length + 1) {
+        return tstrNewWithAllocator(this->allocator);
+    }
+
+    char *data = tstrData(&out);
+    for (const TRopeSegment *segment = this->head; segment; segment = segment->next) {
+        memcpy(data + out.length, segment->data + segment->start, segment->length);
+        out.length += segment->length;
+    }
+
+    data[out.length] = '\0';
+
+    return out;
+}
+
+bool tropeWriteFd(const TRope *this, int fd) {
+#if HAVE_WRITEV
+    const TRopeSegment *segment = this->head;
+    size_t written_part = 0; // Bytes of `segment` which were already written
+
+    while (segment) {
+        struct iovec iov[WRITEV_BATCH];
+        int n_iov = 0;
+
+        size_t skip = written_part;
+        for (const TRopeSegment *it = segment; it && n_iov < WRITEV_BATCH; it = it->next) {
+            if (it->length > skip) {
+                iov[n_iov].iov_base = (char *)it->data + it->start + skip;
+                iov[n_iov].iov_len = it->length - skip;
+                ++n_iov;
+            }
+
+            skip = 0;
+        }
+
+        if (n_iov == 0) {
+            break;
+        }
+
+        ssize_t written = writev(fd, iov, n_iov);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return false;
+        }
+
+        // Skip over everything that was written, the next call picks up in the middle of a segment if needed
+        size_t left = (size_t)written;
+        while (segment && left >= segment->length - written_part) {
+            left -= segment->length - written_part;
+            written_part = 0;
+            segment = segment->next;
+        }
+
+        written_part += left;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool tropeWriteFile(const TRope *this, FILE *file) {
+    for (const TRopeSegment *segment = this->head; segment; segment = segment->next) {
+        if (fwrite(segment->data + segment->start, 1, segment->length, file) != segment->length) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void tropeClear(TRope *this) {
+    TRopeSegment *segment = this->head;
+    while (segment) {
+        TRopeSegment *next = segment->next;
+        deallocate(this, segment);
+        segment = next;
+    }
+
+    this->head = NULL;
+    this->tail = NULL;
+    this->length = 0;
+}
+
+void tropeFree(TRope *this) {
+    tropeClear(this);
+    *this = (TRope) { 0 };
+}
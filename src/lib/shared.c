@@ -0,0 +1,154 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/shared.h"
+
+typedef struct {
+    char c;
+    _TSharedHeader header;
+} HeaderAlignment;
+
+#define HEADER_ALIGNMENT offsetof(HeaderAlignment, header)
+
+// Offset of the header from the start of the buffer, `(size_t)-1` on overflow
+static size_t headerOffset(size_t length) {
+    size_t n_bytes = length + 1;
+    if (n_bytes == 0 || n_bytes > (size_t)-1 - HEADER_ALIGNMENT - sizeof(_TSharedHeader)) {
+        return (size_t)-1;
+    }
+
+    return (n_bytes + HEADER_ALIGNMENT - 1) / HEADER_ALIGNMENT * HEADER_ALIGNMENT;
+}
+
+static char *resizeBuffer(TDynamicAllocator *allocator, char *old, size_t n_bytes) {
+    if (allocator) {
+        return tdaResize(allocator, old, n_bytes);
+    }
+
+    return realloc(old, n_bytes);
+}
+
+static void freeBuffer(TDynamicAllocator *allocator, char *ptr) {
+    if (allocator) {
+        tdaDealloc(allocator, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+// `data` must hold the null-terminated characters and have room for the header at `headerOffset(length)`
+static TSharedString attachHeader(char *data, size_t length, TDynamicAllocator *allocator) {
+    _TSharedHeader *header = (_TSharedHeader *)(data + headerOffset(length));
+    *header = (_TSharedHeader) {
+        .refcount = 1,
+        .length = length,
+        .data = data,
+        .allocator = allocator,
+    };
+
+    return (TSharedString) { .header = header };
+}
+
+TSharedString tsharedNew(TStringView sv) {
+    return tsharedNewWithAllocator(sv, NULL);
+}
+
+TSharedString tsharedNewWithAllocator(TStringView sv, TDynamicAllocator *allocator) {
+    if (sv.length == 0) {
+        return (TSharedString) { 0 };
+    }
+
+    size_t offset = headerOffset(sv.length);
+    if (offset == (size_t)-1) {
+        return (TSharedString) { 0 };
+    }
+
+    char *data = resizeBuffer(allocator, NULL, offset + sizeof(_TSharedHeader));
+    if (!data) {
+        return (TSharedString) { 0 };
+    }
+
+    memcpy(data, sv.data, sv.length);
+    data[sv.length] = '\0';
+
+    return attachHeader(data, sv.length, allocator);
+}
+
+TSharedString tsharedFromStr(TString *str) {
+    if (tstrIsInline(str)) {
+        TSharedString shared = tsharedNewWithAllocator(tsvNewFromStr(str), str->allocator);
+        if (shared.header || str->length == 0) {
+            tstrFree(str);
+        }
+
+        return shared;
+    }
+
+    size_t offset = headerOffset(str->length);
+    if (offset == (size_t)-1) {
+        return (TSharedString) { 0 };
+    }
+
+    char *data = str->buf.heap;
+    if (str->capacity < offset + sizeof(_TSharedHeader)) {
+        data = resizeBuffer(str->allocator, data, offset + sizeof(_TSharedHeader));
+        if (!data) {
+            return (TSharedString) { 0 };
+        }
+    }
+
+    TSharedString shared = attachHeader(data, str->length, str->allocator);
+    *str = tstrNewWithAllocator(str->allocator);
+
+    return shared;
+}
+
+TSharedString tsharedDup(const TSharedString *this) {
+    if (this->header) {
+        __atomic_fetch_add(&this->header->refcount, 1, __ATOMIC_RELAXED);
+    }
+
+    return *this;
+}
+
+bool tsharedIsUnique(const TSharedString *this) {
+    return !this->header || __atomic_load_n(&this->header->refcount, __ATOMIC_ACQUIRE) == 1;
+}
+
+TString tsharedIntoStr(TSharedString *this) {
+    _TSharedHeader *header = this->header;
+    if (!header) {
+        return tstrNew();
+    }
+
+    // Inline strings must stay inline, so short buffers are always copied
+    if (header->length + 1 > TSTR_INLINE_CAPACITY && tsharedIsUnique(this)) {
+        TString str = {
+            .length = header->length,
+            .capacity = (size_t)((char *)header - header->data),
+            .buf.heap = header->data,
+            .allocator = header->allocator,
+        };
+
+        this->header = NULL;
+        return str;
+    }
+
+    TString str = tstrNewWithAllocator(header->allocator);
+    tstrCat(&str, tsvNewFromShared(this));
+    tsharedFree(this);
+
+    return str;
+}
+
+void tsharedFree(TSharedString *this) {
+    _TSharedHeader *header = this->header;
+    this->header = NULL;
+
+    if (!header || __atomic_sub_fetch(&header->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    freeBuffer(header->allocator, header->data);
+}
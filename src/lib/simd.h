@@ -0,0 +1,90 @@
+#ifndef CTL_SIMD_H
+#define CTL_SIMD_H
+
+// Helpers shared by the vectorised parts of the library, not part of the public interface
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define CTL_SIMD_X86 1
+#include <immintrin.h>
+
+// Functions marked with this may only be called after `simdHasAvx2` returned `true`
+#define CTL_TARGET_AVX2 __attribute__((target("avx2")))
+
+static inline bool simdHasAvx2(void) {
+    static int cached = -1;
+
+    int has = __atomic_load_n(&cached, __ATOMIC_RELAXED);
+    if (has < 0) {
+        __builtin_cpu_init();
+        has = __builtin_cpu_supports("avx2") ? 1 : 0;
+        __atomic_store_n(&cached, has, __ATOMIC_RELAXED);
+    }
+
+    return has;
+}
+#else
+#define CTL_SIMD_X86 0
+
+static inline bool simdHasAvx2(void) {
+    return false;
+}
+#endif
+
+static inline unsigned simdCtz32(uint32_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(n);
+#else
+    unsigned i = 0;
+    while (!(n & 1)) {
+        n >>= 1;
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+static inline unsigned simdCtz64(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(n);
+#else
+    unsigned i = 0;
+    while (!(n & 1)) {
+        n >>= 1;
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+static inline unsigned simdPopcount64(uint64_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_popcountll(n);
+#else
+    n -= (n >> 1) & UINT64_C(0x5555555555555555);
+    n = (n & UINT64_C(0x3333333333333333)) + ((n >> 2) & UINT64_C(0x3333333333333333));
+    n = (n + (n >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+
+    return (unsigned)((n * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+// Index of the highest set bit, `n` must not be `0`
+static inline unsigned simdHighBit32(uint32_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - __builtin_clz(n);
+#else
+    unsigned i = 0;
+    while (n >>= 1) {
+        ++i;
+    }
+
+    return i;
+#endif
+}
+
+#endif
@@ -0,0 +1,439 @@
+// posix_memalign and sched_yield are not part of C99
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctl/alloc.h"
+#include "ctl/def.h"
+#include "spin.h"
+
+#define SLAB_SIZE ((size_t)64 * 1024)
+#define SLAB_HEADER_SIZE 64
+#define LARGE_HEADER_SIZE 16
+#define N_CLASSES 36
+#define MAGAZINE_SIZE 64
+#define CACHE_LINE 64
+
+// Slabs are registered in a two level bitmap with one bit per `SLAB_SIZE` window of the address space,
+// which covers 48 bit addresses
+#define WINDOW_BITS 32
+#define LEAF_BITS 20
+
+// Placed at the start of every slab.
+// Slabs are aligned to `SLAB_SIZE`, so the header of any object can be found by masking its address.
+typedef struct {
+    size_t size_class;
+    size_t size;
+} SlabHeader;
+
+// Placed before every large allocation, which is a plain `malloc` block
+typedef struct {
+    size_t size;
+} LargeHeader;
+
+typedef struct Magazine {
+    struct Magazine *next;
+    size_t count;
+    void *items[MAGAZINE_SIZE];
+} Magazine;
+
+typedef struct {
+    int lock;
+    Magazine *full;  // Magazines with at least one object
+    Magazine *empty; // Magazines with no objects
+} Depot;
+
+// Threads using different size classes must not contend for the cache line of a depot
+typedef union {
+    Depot depot;
+    unsigned char padding[CACHE_LINE];
+} PaddedDepot;
+
+typedef struct {
+    Magazine *loaded;
+    Magazine *previous;
+    unsigned char *cursor; // Next object in the slab owned by this thread
+    unsigned char *end;
+} ThreadCache;
+
+static const size_t class_sizes[N_CLASSES] = {
+    16,    32,    48,    64,    80,    96,    112,   128,
+    160,   192,   224,   256,   320,   384,   448,   512,
+    640,   768,   896,   1024,  1280,  1536,  1792,  2048,
+    2560,  3072,  3584,  4096,  5120,  6144,  7168,  8192,
+    10240, 12288, 14336, 16384,
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((aligned(CACHE_LINE)))
+#endif
+static PaddedDepot depots[N_CLASSES];
+static uint64_t *slab_windows[(size_t)1 << (WINDOW_BITS - LEAF_BITS)];
+static CTL_THREAD_LOCAL ThreadCache thread_caches[N_CLASSES];
+
+static size_t highestBit(size_t n) {
+#if defined(__GNUC__) || defined(__clang__)
+    return sizeof (unsigned long long) * 8 - 1 - __builtin_clzll(n);
+#else
+    size_t bit = 0;
+    while (n >>= 1) {
+        ++bit;
+    }
+
+    return bit;
+#endif
+}
+
+static size_t sizeClass(size_t n_bytes) {
+    if (n_bytes <= 128) {
+        return n_bytes == 0 ? 0 : (n_bytes + 15) / 16 - 1;
+    }
+
+    size_t m = n_bytes - 1;
+    size_t bit = highestBit(m);
+
+    return 8 + (bit - 7) * 4 + ((m >> (bit - 2)) & 3);
+}
+
+// Number of objects a magazine of the given class holds, larger objects get smaller magazines
+static size_t magazineRounds(size_t size_class) {
+    size_t rounds = 16384 / class_sizes[size_class];
+    if (rounds > MAGAZINE_SIZE) {
+        return MAGAZINE_SIZE;
+    }
+
+    return rounds < 8 ? 8 : rounds;
+}
+
+static SlabHeader *headerOf(const void *ptr) {
+    return (SlabHeader *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static LargeHeader *largeHeaderOf(const void *ptr) {
+    return (LargeHeader *)((unsigned char *)ptr - LARGE_HEADER_SIZE);
+}
+
+// Records that the window of `slab` holds a slab, fails if the address is out of range or a leaf can't be allocated.
+// Slabs are never deallocated, so bits are never cleared.
+static bool registerSlab(const SlabHeader *slab) {
+    uint64_t window = (uintptr_t)slab / SLAB_SIZE;
+    if (window >> WINDOW_BITS) {
+        return false;
+    }
+
+    uint64_t **root = slab_windows + (window >> LEAF_BITS);
+    uint64_t *leaf = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+    if (!leaf) {
+        uint64_t *fresh = calloc(((size_t)1 << LEAF_BITS) / 64, sizeof *fresh);
+        if (!fresh) {
+            return false;
+        }
+
+        if (__atomic_compare_exchange_n(root, &leaf, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            leaf = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+
+    size_t bit = (size_t)(window & (((uint64_t)1 << LEAF_BITS) - 1));
+    __atomic_fetch_or(leaf + bit / 64, (uint64_t)1 << (bit % 64), __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Whether `ptr` points into a slab rather than a large allocation
+static bool isSlabObject(const void *ptr) {
+    uint64_t window = (uintptr_t)ptr / SLAB_SIZE;
+    if (window >> WINDOW_BITS) {
+        return false;
+    }
+
+    const uint64_t *leaf = __atomic_load_n(slab_windows + (window >> LEAF_BITS), __ATOMIC_ACQUIRE);
+    if (!leaf) {
+        return false;
+    }
+
+    size_t bit = (size_t)(window & (((uint64_t)1 << LEAF_BITS) - 1));
+    return (__atomic_load_n(leaf + bit / 64, __ATOMIC_ACQUIRE) >> (bit % 64)) & 1;
+}
+
+static void lockDepot(Depot *depot) {
+    spinLock(&depot->lock);
+}
+
+static void unlockDepot(Depot *depot) {
+    spinUnlock(&depot->lock);
+}
+
+static void pushMagazine(Magazine **list, Magazine *magazine) {
+    magazine->next = *list;
+    *list = magazine;
+}
+
+static Magazine *popMagazine(Magazine **list) {
+    Magazine *magazine = *list;
+    if (magazine) {
+        *list = magazine->next;
+    }
+
+    return magazine;
+}
+
+static Magazine *newMagazine(void) {
+    Magazine *magazine = malloc(sizeof *magazine);
+    if (magazine) {
+        magazine->next = NULL;
+        magazine->count = 0;
+    }
+
+    return magazine;
+}
+
+// Carves an object out of the slab owned by the calling thread
+static void *carve(ThreadCache *cache, size_t size_class) {
+    size_t size = class_sizes[size_class];
+
+    if (!cache->cursor || (size_t)(cache->end - cache->cursor) < size) {
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, SLAB_SIZE, SLAB_SIZE) != 0) {
+            return NULL;
+        }
+
+        SlabHeader *slab = ptr;
+        if (!registerSlab(slab)) {
+            free(slab);
+            return NULL;
+        }
+
+        slab->size_class = size_class;
+        slab->size = size;
+
+        cache->cursor = (unsigned char *)slab + SLAB_HEADER_SIZE;
+        cache->end = (unsigned char *)slab + SLAB_SIZE;
+    }
+
+    void *obj = cache->cursor;
+    cache->cursor += size;
+
+    return obj;
+}
+
+// Slow path of `tslabAlloc`, both magazines of the thread are empty
+static void *allocRefill(ThreadCache *cache, size_t size_class) {
+    Depot *depot = &depots[size_class].depot;
+
+    lockDepot(depot);
+
+    Magazine *full = popMagazine(&depot->full);
+    if (full && cache->previous) {
+        pushMagazine(&depot->empty, cache->previous);
+        cache->previous = NULL;
+    }
+
+    unlockDepot(depot);
+
+    if (!full) {
+        return carve(cache, size_class);
+    }
+
+    cache->previous = cache->loaded;
+    cache->loaded = full;
+
+    return full->items[--full->count];
+}
+
+static void *allocLarge(size_t n_bytes) {
+    if (n_bytes > (size_t)-1 - LARGE_HEADER_SIZE) {
+        return NULL;
+    }
+
+    LargeHeader *header = malloc(LARGE_HEADER_SIZE + n_bytes);
+    if (!header) {
+        return NULL;
+    }
+
+    header->size = n_bytes;
+
+    return (unsigned char *)header + LARGE_HEADER_SIZE;
+}
+
+void *tslabAlloc(size_t n_bytes) {
+    if (n_bytes > TSLAB_MAX_SIZE) {
+        return allocLarge(n_bytes);
+    }
+
+    size_t size_class = sizeClass(n_bytes);
+    ThreadCache *cache = thread_caches + size_class;
+
+    Magazine *loaded = cache->loaded;
+    if (loaded && loaded->count > 0) {
+        return loaded->items[--loaded->count];
+    }
+
+    Magazine *previous = cache->previous;
+    if (previous && previous->count > 0) {
+        cache->previous = loaded;
+        cache->loaded = previous;
+        return previous->items[--previous->count];
+    }
+
+    return allocRefill(cache, size_class);
+}
+
+// Slow path of `tslabDealloc`, both magazines of the thread are full (or missing)
+static void deallocExchange(ThreadCache *cache, size_t size_class, void *ptr) {
+    Depot *depot = &depots[size_class].depot;
+
+    lockDepot(depot);
+
+    if (cache->previous) {
+        pushMagazine(&depot->full, cache->previous);
+    }
+
+    Magazine *empty = popMagazine(&depot->empty);
+
+    unlockDepot(depot);
+
+    cache->previous = cache->loaded;
+    cache->loaded = empty ? empty : newMagazine();
+
+    // Without a magazine there is nowhere to keep the object, it is leaked
+    if (cache->loaded) {
+        cache->loaded->items[cache->loaded->count++] = ptr;
+    }
+}
+
+void tslabDealloc(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    if (!isSlabObject(ptr)) {
+        free(largeHeaderOf(ptr));
+        return;
+    }
+
+    size_t size_class = headerOf(ptr)->size_class;
+
+    ThreadCache *cache = thread_caches + size_class;
+    size_t rounds = magazineRounds(size_class);
+
+    Magazine *loaded = cache->loaded;
+    if (loaded && loaded->count < rounds) {
+        loaded->items[loaded->count++] = ptr;
+        return;
+    }
+
+    Magazine *previous = cache->previous;
+    if (previous && previous->count < rounds) {
+        cache->previous = loaded;
+        cache->loaded = previous;
+        previous->items[previous->count++] = ptr;
+        return;
+    }
+
+    deallocExchange(cache, size_class, ptr);
+}
+
+size_t tslabSize(const void *ptr) {
+    return isSlabObject(ptr) ? headerOf(ptr)->size : largeHeaderOf(ptr)->size;
+}
+
+void *tslabResize(void *old, size_t n_bytes) {
+    if (!old) {
+        return tslabAlloc(n_bytes);
+    }
+
+    bool small = isSlabObject(old);
+    if (small && n_bytes <= TSLAB_MAX_SIZE && sizeClass(n_bytes) == headerOf(old)->size_class) {
+        return old;
+    }
+
+    if (!small && n_bytes > TSLAB_MAX_SIZE && n_bytes <= (size_t)-1 - LARGE_HEADER_SIZE) {
+        LargeHeader *header = realloc(largeHeaderOf(old), LARGE_HEADER_SIZE + n_bytes);
+        if (!header) {
+            return NULL;
+        }
+
+        header->size = n_bytes;
+        return (unsigned char *)header + LARGE_HEADER_SIZE;
+    }
+
+    void *new_block = tslabAlloc(n_bytes);
+    if (!new_block) {
+        return NULL;
+    }
+
+    size_t old_bytes = tslabSize(old);
+    memcpy(new_block, old, old_bytes < n_bytes ? old_bytes : n_bytes);
+
+    tslabDealloc(old);
+
+    return new_block;
+}
+
+void tslabFlushThread(void) {
+    for (size_t i = 0; i < N_CLASSES; ++i) {
+        ThreadCache *cache = thread_caches + i;
+
+        // Hand out the rest of the thread's slab as well
+        size_t size = class_sizes[i];
+        while (cache->cursor && (size_t)(cache->end - cache->cursor) >= size) {
+            void *obj = cache->cursor;
+            cache->cursor += size;
+            tslabDealloc(obj);
+        }
+
+        Depot *depot = &depots[i].depot;
+        Magazine *magazines[2] = { cache->loaded, cache->previous };
+
+        lockDepot(depot);
+
+        for (size_t j = 0; j < 2; ++j) {
+            if (!magazines[j]) {
+                continue;
+            }
+
+            pushMagazine(magazines[j]->count > 0 ? &depot->full : &depot->empty, magazines[j]);
+        }
+
+        unlockDepot(depot);
+
+        *cache = (ThreadCache) { 0 };
+    }
+}
+
+static void *slabAllocWrapper(size_t n_bytes, void *userdata) {
+    (void)userdata;
+    return tslabAlloc(n_bytes);
+}
+
+static void *slabResizeWrapper(void *old, size_t n_bytes, void *userdata) {
+    (void)userdata;
+    return tslabResize(old, n_bytes);
+}
+
+static void slabDeallocWrapper(void *ptr, void *userdata) {
+    (void)userdata;
+    tslabDealloc(ptr);
+}
+
+static size_t slabSizeWrapper(const void *ptr, void *userdata) {
+    (void)userdata;
+    return tslabSize(ptr);
+}
+
+TDynamicAllocator tdaSlab(void) {
+    return (TDynamicAllocator) {
+        .alloc = slabAllocWrapper,
+        .resize = slabResizeWrapper,
+        .dealloc = slabDeallocWrapper,
+        .cleanup = NULL,
+        .userdata = NULL,
+        .size = slabSizeWrapper,
+    };
+}
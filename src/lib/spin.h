@@ -0,0 +1,57 @@
+#ifndef CTL_SPIN_H
+#define CTL_SPIN_H
+
+// Spinlock for the short critical sections of the library, not part of the public interface
+// On unix, files including this must request POSIX definitions for `sched_yield`
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#define HAVE_SCHED_YIELD 1
+#else
+#define HAVE_SCHED_YIELD 0
+#endif
+
+// Waiting longer than this many pauses usually means the holder was preempted, so the time slice is given up
+#define SPIN_MAX_BACKOFF 64
+
+static inline void spinPause(void) {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__aarch64__) || defined(__arm__))
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void spinYield(void) {
+#if HAVE_SCHED_YIELD
+    sched_yield();
+#else
+    spinPause();
+#endif
+}
+
+static inline void spinLock(int *lock) {
+    unsigned backoff = 1;
+
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        // Waiting on a plain load keeps the cache line shared until the holder releases it
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            if (backoff > SPIN_MAX_BACKOFF) {
+                spinYield();
+                continue;
+            }
+
+            for (unsigned i = 0; i < backoff; ++i) {
+                spinPause();
+            }
+
+            backoff *= 2;
+        }
+    }
+}
+
+static inline void spinUnlock(int *lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+#endif
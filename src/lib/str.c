@@ -1,4 +1,3 @@
-#include <ctype.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +8,18 @@ TString tstrNew(void) {
     return (TString) {
         .length = 0,
         .capacity = 0,
-        .data = NULL,
+        .buf = { .small = { 0 } },
+        .allocator = NULL,
     };
 }
 
+TString tstrNewWithAllocator(TDynamicAllocator *allocator) {
+    TString str = tstrNew();
+    str.allocator = allocator;
+
+    return str;
+}
+
 TString tstrNewFromC(const char *cstr) {
     return tstrNewFromBuf((const unsigned char *)cstr, strlen(cstr));
 }
@@ -20,13 +27,15 @@ TString tstrNewFromC(const char *cstr) {
 TString tstrNewFromBuf(const unsigned char *buf, size_t n) {
     TString str = tstrNew();
     tstrReserve(&str, n + 1);
-    if (!str.data) {
+    if (str.capacity < n + 1) {
         return tstrNew();
     }
 
+    char *data = tstrData(&str);
+
     str.length = n;
-    memcpy(str.data, buf, n);
-    str.data[n] = '\0';
+    memcpy(data, buf, n);
+    data[n] = '\0';
 
     return str;
 }
@@ -36,7 +45,10 @@ TString tstrNewFromView(TStringView view) {
 }
 
 TString tstrDup(const TString *this) {
-    return tstrNewFromBuf((const unsigned char *)this->data, this->length);
+    TString str = tstrNewWithAllocator(this->allocator);
+    tstrCat(&str, tsvNewFromStr(this));
+
+    return str;
 }
 
 // StringView constructors
@@ -64,70 +76,128 @@ TStringView tsvNewFromBuf(const unsigned char *buf, size_t n) {
 TStringView tsvNewFromStr(const TString *str) {
     return (TStringView) {
         .length = str->length,
-        .data = str->data,
+        .data = tstrData(str),
     };
 }
 
 TStringView tsvNewFromStrBounds(const TString *str, size_t start, size_t length) {
     return (TStringView) {
         .length = length,
-        .data = str->data + start,
+        .data = tstrData(str) + start,
     };
 }
 
 // Memory operations
 TString tstrMove(TString *old) {
     TString ret = *old;
-    *old = tstrNew();
+    *old = tstrNewWithAllocator(old->allocator);
 
     return ret;
 }
 
+// Allocates a new heap buffer if `old` is `NULL`, resizes `old` otherwise
+static char *resizeBuffer(TString *this, char *old, size_t n_bytes) {
+    if (this->allocator) {
+        return tdaResize(this->allocator, old, n_bytes);
+    }
+
+    return realloc(old, n_bytes);
+}
+
+static void freeBuffer(TString *this, char *ptr) {
+    if (this->allocator) {
+        tdaDealloc(this->allocator, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
 void tstrReserve(TString *this, size_t min_cap) {
     if (this->capacity >= min_cap) {
         return;
     }
 
-    this->capacity *= 2;
-    if (this->capacity < min_cap) {
-        this->capacity = min_cap;
+    if (min_cap <= TSTR_INLINE_CAPACITY) {
+        // Still fits inline, only claim the whole inline buffer
+        this->capacity = TSTR_INLINE_CAPACITY;
+        return;
+    }
+
+    size_t capacity = this->capacity * 2;
+    if (capacity < min_cap) {
+        capacity = min_cap;
     }
 
-    this->data = realloc(this->data, this->capacity);
-    if (!this->data) {
-        this->length = 0;
-        this->capacity = 0;
+    if (tstrIsInline(this)) {
+        char *data = resizeBuffer(this, NULL, capacity);
+        if (!data) {
+            return;
+        }
+
+        memcpy(data, this->buf.small, this->length);
+        data[this->length] = '\0';
+
+        this->buf.heap = data;
+        this->capacity = capacity;
+        return;
     }
+
+    char *data = resizeBuffer(this, this->buf.heap, capacity);
+    if (!data) {
+        tstrFree(this);
+        return;
+    }
+
+    this->buf.heap = data;
+    this->capacity = capacity;
 }
 
 void tstrShrink(TString *this) {
-    if (this->capacity == this->length) {
+    // Keep room for the null terminator
+    if (tstrIsInline(this) || this->capacity == this->length + 1) {
+        return;
+    }
+
+    char *heap = this->buf.heap;
+
+    if (this->length < TSTR_INLINE_CAPACITY) {
+        memcpy(this->buf.small, heap, this->length);
+        this->buf.small[this->length] = '\0';
+        this->capacity = TSTR_INLINE_CAPACITY;
+
+        freeBuffer(this, heap);
         return;
     }
 
-    this->capacity = this->length;
-    this->data = realloc(this->data, this->capacity);
-    if (!this->data) {
-        this->length = 0;
-        this->capacity = 0;
+    char *data = resizeBuffer(this, heap, this->length + 1);
+    if (!data) {
+        return;
     }
+
+    this->buf.heap = data;
+    this->capacity = this->length + 1;
 }
 
 void tstrFree(TString *this) {
-    free(this->data);
-    *this = tstrNew();
+    if (!tstrIsInline(this)) {
+        freeBuffer(this, this->buf.heap);
+    }
+
+    *this = tstrNewWithAllocator(this->allocator);
 }
 
 // Modification
 void tstrAppend(TString *this, char c) {
     tstrReserve(this, this->length + 2); // New char + null terminator
 
-    if (!this->data) {
+    if (this->capacity < this->length + 2) {
         return;
     }
 
-    this->data[this->length] = c;
-    this->data[this->length + 1] = '\0';
+    char *data = tstrData(this);
+
+    data[this->length] = c;
+    data[this->length + 1] = '\0';
     ++this->length;
 }
 
@@ -137,17 +207,20 @@ void tstrPop(TString *this) {
     }
 
     --this->length;
+    tstrData(this)[this->length] = '\0';
 }
 
 void tstrCat(TString *this, TStringView that) {
     tstrReserve(this, this->length + that.length + 1); // +1 for the null terminator
-    if (!this->data) {
+    if (this->capacity < this->length + that.length + 1) {
         return;
     }
 
-    memcpy(this->data + this->length, that.data, that.length);
+    char *data = tstrData(this);
+
+    memcpy(data + this->length, that.data, that.length);
     this->length += that.length;
-    this->data[this->length] = '\0';
+    data[this->length] = '\0';
 }
 
 void tstrTrunc(TString *this, size_t new_len_max) {
@@ -156,6 +229,7 @@ void tstrTrunc(TString *this, size_t new_len_max) {
     }
 
     this->length = new_len_max;
+    tstrData(this)[this->length] = '\0';
 }
 
 // Query
@@ -167,73 +241,173 @@ int tstrCmpC(const TString *this, const char *cstr) {
     return tsvCmp(tsvNewFromStr(this), tsvNewFromC(cstr));
 }
 
-int tsvCmp(TStringView this, TStringView that) {
-    if (this.length == 0 && that.length == 0) {
-        return 0;
+// Unaligned native endian reads
+static uint64_t load64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+static uint32_t load32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// Compares `n` bytes for equality, short inputs are covered by two possibly overlapping loads
+static bool bytesEq(const char *a, const char *b, size_t n) {
+    if (n >= 8) {
+        if (n > 16) {
+            return memcmp(a, b, n) == 0;
+        }
+
+        return ((load64(a) ^ load64(b)) | (load64(a + n - 8) ^ load64(b + n - 8))) == 0;
+    }
+
+    if (n >= 4) {
+        return ((load32(a) ^ load32(b)) | (load32(a + n - 4) ^ load32(b + n - 4))) == 0;
     }
 
-    for (size_t i = 0; i < this.length && i < that.length; ++i) {
-        char a = this.data[i];
-        char b = that.data[i];
+    if (n == 0) {
+        return true;
+    }
 
-        if (a != b) {
-            return (unsigned char)a - (unsigned char)b;
+    return a[0] == b[0] && a[n / 2] == b[n / 2] && a[n - 1] == b[n - 1];
+}
+
+// Lowercases the ASCII letters among 8 bytes at once, leaving every other byte alone
+static uint64_t lower64(uint64_t v) {
+    const uint64_t high_bits = 0x8080808080808080;
+
+    uint64_t heptets = v & ~high_bits;
+    uint64_t above_z = heptets + 0x2525252525252525;    // High bit set for bytes above 'Z'
+    uint64_t from_a = heptets + 0x3F3F3F3F3F3F3F3F;     // High bit set for bytes from 'A'
+    uint64_t upper = (from_a ^ above_z) & ~v & high_bits;
+
+    return v | (upper >> 2);
+}
+
+static unsigned char lower(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Compares the first `n` bytes, ignoring ASCII case
+static int bytesCmpNoCase(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+
+    // Skip the words which are equal, the first differing one is compared bytewise
+    while (i + 8 <= n && lower64(load64(a + i)) == lower64(load64(b + i))) {
+        i += 8;
+    }
+
+    for (; i < n; ++i) {
+        unsigned char ca = lower(a[i]);
+        unsigned char cb = lower(b[i]);
+
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+static int cmpLengths(size_t a, size_t b) {
+    return a < b ? -1 : a > b;
+}
+
+int tsvCmp(TStringView this, TStringView that) {
+    size_t n = this.length < that.length ? this.length : that.length;
+
+    if (n > 0) {
+        int cmp = memcmp(this.data, that.data, n);
+        if (cmp != 0) {
+            return cmp;
         }
     }
 
-    return (int)this.length - (int)that.length;
+    return cmpLengths(this.length, that.length);
 }
 
 int tsvCmpC(TStringView this, const char *cstr) {
     return tsvCmp(this, tsvNewFromC(cstr));
 }
 
+int tsvCmpNoCase(TStringView this, TStringView that) {
+    size_t n = this.length < that.length ? this.length : that.length;
+
+    int cmp = bytesCmpNoCase(this.data, that.data, n);
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    return cmpLengths(this.length, that.length);
+}
+
 bool tstrEq(const TString *this, const TString *that) {
-    return tstrCmp(this, that) == 0;
+    return tsvEq(tsvNewFromStr(this), tsvNewFromStr(that));
 }
 
 bool tstrEqC(const TString *this, const char *cstr) {
-    return tstrCmpC(this, cstr) == 0;
+    return tsvEqC(tsvNewFromStr(this), cstr);
 }
 
 bool tsvEq(TStringView this, TStringView that) {
-    return tsvCmp(this, that) == 0;
+    return this.length == that.length && bytesEq(this.data, that.data, this.length);
 }
 
 bool tsvEqC(TStringView this, const char *cstr) {
-    return tsvCmpC(this, cstr) == 0;
+    return tsvEq(this, tsvNewFromC(cstr));
 }
 
-// FNV-1a
-uint64_t tsvHash(TStringView sv) {
-    uint64_t h = 0xCBF29CE484222325;
+bool tsvEqNoCase(TStringView this, TStringView that) {
+    if (this.length != that.length) {
+        return false;
+    }
+
+    size_t n = this.length;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        if (lower64(load64(this.data + i)) != lower64(load64(that.data + i))) {
+            return false;
+        }
+    }
 
-    for (size_t i = 0; i < sv.length; ++i) {
-        h ^= sv.data[i];
-        h *= 0x100000001B3;
+    // The last word may overlap the ones compared above
+    if (n >= 8) {
+        return lower64(load64(this.data + n - 8)) == lower64(load64(that.data + n - 8));
     }
 
-    return h;
+    return bytesCmpNoCase(this.data, that.data, n) == 0;
 }
 
-size_t tstrIndexOfFirst(const TString *str, TStringView candidates) {
-    return tsvIndexOfFirst(tsvNewFromStr(str), candidates);
+bool tstrStartsWith(const TString *str, TStringView prefix) {
+    return tsvStartsWith(tsvNewFromStr(str), prefix);
 }
 
-size_t tsvIndexOfFirst(TStringView sv, TStringView candidates) {
-    bool table[1ULL << sizeof (char) * 8] = { 0 };
+bool tsvStartsWith(TStringView sv, TStringView prefix) {
+    return sv.length >= prefix.length && bytesEq(sv.data, prefix.data, prefix.length);
+}
 
-    for (size_t i = 0; i < candidates.length; ++i) {
-        table[(unsigned char)candidates.data[i]] = true;
-    }
+bool tstrEndsWith(const TString *str, TStringView suffix) {
+    return tsvEndsWith(tsvNewFromStr(str), suffix);
+}
 
-    for (size_t i = 0; i < sv.length; ++i) {
-        if (table[(unsigned char)sv.data[i]]) {
-            return i;
-        }
+bool tsvEndsWith(TStringView sv, TStringView suffix) {
+    return sv.length >= suffix.length && bytesEq(sv.data + sv.length - suffix.length, suffix.data, suffix.length);
+}
+
+bool tsvStartsWithNoCase(TStringView sv, TStringView prefix) {
+    return sv.length >= prefix.length && tsvEqNoCase(tsvNewFromBuf((const unsigned char *)sv.data, prefix.length), prefix);
+}
+
+bool tsvEndsWithNoCase(TStringView sv, TStringView suffix) {
+    if (sv.length < suffix.length) {
+        return false;
     }
 
-    return (size_t)-1;
+    return tsvEqNoCase(tsvNewFromBuf((const unsigned char *)sv.data + sv.length - suffix.length, suffix.length), suffix);
 }
 
 TStringView tstrStripSpaces(const TString *str) {
@@ -241,31 +415,18 @@ TStringView tstrStripSpaces(const TString *str) {
 }
 
 TStringView tsvStripSpaces(TStringView sv) {
-    if (sv.length == 0) {
+    TStringView spaces = tsvNewFromL(" \t\n\v\f\r");
+
+    size_t start = tsvIndexOfFirstNot(sv, spaces);
+    if (start == (size_t)-1 && sv.length == 0) {
         return sv;
     }
 
-    size_t start = 0, length = sv.length;
-
-    for (size_t i = 0; i < sv.length; ++i) {
-        if (!isspace(sv.data[i])) {
-            break;
-        }
-
-        ++start;
-        --length;
+    if (start == (size_t)-1) {
+        return tsvNewFromBuf((const unsigned char *)sv.data + sv.length, 0);
     }
 
-    for (int32_t i = sv.length - 1; i > start; --i) {
-        if (!isspace(sv.data[i])) {
-            break;
-        }
-
-        --length;
-    }
+    size_t end = tsvIndexOfLastNot(sv, spaces) + 1;
 
-    return (TStringView) {
-        .data = sv.data + start,
-        .length = length,
-    };
+    return tsvNewFromBuf((const unsigned char *)sv.data + start, end - start);
 }
@@ -0,0 +1,971 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ctl/str.h"
+#include "simd.h"
+
+#define NOT_FOUND ((size_t)-1)
+
+// A set of bytes, laid out for nibble based lookups
+typedef _TCharSet CharSet;
+
+static bool charSetHas(const CharSet *set, unsigned char c) {
+    uint8_t row = c < 0x80 ? set->lo[c & 15] : set->hi[c & 15];
+    return (row >> ((c >> 4) & 7)) & 1;
+}
+
+static void charSetInit(CharSet *set, TStringView candidates) {
+    memset(set, 0, sizeof *set);
+
+    for (size_t i = 0; i < candidates.length; ++i) {
+        unsigned char c = candidates.data[i];
+        if (charSetHas(set, c)) {
+            continue;
+        }
+
+        uint8_t *row = c < 0x80 ? set->lo + (c & 15) : set->hi + (c & 15);
+        *row |= 1 << ((c >> 4) & 7);
+
+        if (set->n_chars < sizeof set->chars) {
+            set->chars[set->n_chars] = c;
+        }
+
+        ++set->n_chars;
+    }
+}
+
+static size_t scalarFind(const unsigned char *data, size_t n, const CharSet *set, bool negate, bool reverse) {
+    if (reverse) {
+        for (size_t i = n; i-- > 0;) {
+            if (charSetHas(set, data[i]) != negate) {
+                return i;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            if (charSetHas(set, data[i]) != negate) {
+                return i;
+            }
+        }
+    }
+
+    return NOT_FOUND;
+}
+
+#if CTL_SIMD_X86
+// Compares against up to 8 characters, one comparison per character
+static size_t sse2Find(const unsigned char *data, size_t n, const CharSet *set, bool negate, bool reverse) {
+    __m128i chars[8];
+    for (size_t k = 0; k < set->n_chars; ++k) {
+        chars[k] = _mm_set1_epi8((char)set->chars[k]);
+    }
+
+    uint32_t flip = negate ? 0xFFFF : 0;
+
+#define SSE2_MASK(v, out) do { \
+        __m128i eq = _mm_cmpeq_epi8((v), chars[0]); \
+        for (size_t k = 1; k < set->n_chars; ++k) { \
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8((v), chars[k])); \
+        } \
+        (out) = ((uint32_t)_mm_movemask_epi8(eq)) ^ flip; \
+    } while (0)
+
+    if (reverse) {
+        size_t i = n;
+        while (i >= 16) {
+            i -= 16;
+
+            uint32_t mask;
+            SSE2_MASK(_mm_loadu_si128((const __m128i *)(data + i)), mask);
+            if (mask) {
+                return i + simdHighBit32(mask);
+            }
+        }
+
+        return scalarFind(data, i, set, negate, true);
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint32_t mask;
+        SSE2_MASK(_mm_loadu_si128((const __m128i *)(data + i)), mask);
+        if (mask) {
+            return i + simdCtz32(mask);
+        }
+    }
+
+#undef SSE2_MASK
+
+    size_t rest = scalarFind(data + i, n - i, set, negate, false);
+    return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+
+// Looks up the row of every byte by its low nibble and tests the bit selected by its high nibble,
+// which handles sets of any size in a constant number of instructions
+CTL_TARGET_AVX2
+static uint32_t avx2ClassMask(__m256i v, __m256i lo_table, __m256i hi_table, __m256i bit_table) {
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+
+    // Bytes with the top bit set take their row from `hi_table`
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo_table, lo), _mm256_shuffle_epi8(hi_table, lo), v);
+    __m256i bit = _mm256_shuffle_epi8(bit_table, hi);
+
+    __m256i hit = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+    return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+CTL_TARGET_AVX2
+static size_t avx2Find(const unsigned char *data, size_t n, const CharSet *set, bool negate, bool reverse) {
+    __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo));
+    __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hi));
+    __m256i bit_table = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128,
+        1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128
+    );
+
+    bool single = set->n_chars == 1;
+    __m256i c = _mm256_set1_epi8((char)set->chars[0]);
+    uint32_t flip = negate ? 0xFFFFFFFF : 0;
+
+#define AVX2_MASK(v) ((single \
+        ? (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), c)) \
+        : avx2ClassMask((v), lo_table, hi_table, bit_table)) ^ flip)
+
+    if (reverse) {
+        size_t i = n;
+        while (i >= 32) {
+            i -= 32;
+
+            uint32_t mask = AVX2_MASK(_mm256_loadu_si256((const __m256i *)(data + i)));
+            if (mask) {
+                return i + simdHighBit32(mask);
+            }
+        }
+
+        return scalarFind(data, i, set, negate, true);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        uint32_t mask = AVX2_MASK(_mm256_loadu_si256((const __m256i *)(data + i)));
+        if (mask) {
+            return i + simdCtz32(mask);
+        }
+    }
+
+#undef AVX2_MASK
+
+    size_t rest = scalarFind(data + i, n - i, set, negate, false);
+    return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+#endif
+
+static size_t find(TStringView sv, TStringView candidates, bool negate, bool reverse) {
+    if (sv.length == 0) {
+        return NOT_FOUND;
+    }
+
+    CharSet set;
+    charSetInit(&set, candidates);
+
+    if (set.n_chars == 0) {
+        if (!negate) {
+            return NOT_FOUND;
+        }
+
+        return reverse ? sv.length - 1 : 0;
+    }
+
+    const unsigned char *data = (const unsigned char *)sv.data;
+
+    // libc already provides a vectorised search for this case
+    if (set.n_chars == 1 && !negate && !reverse) {
+        const unsigned char *found = memchr(data, set.chars[0], sv.length);
+        return found ? (size_t)(found - data) : NOT_FOUND;
+    }
+
+#if CTL_SIMD_X86
+    if (sv.length >= 32 && simdHasAvx2()) {
+        return avx2Find(data, sv.length, &set, negate, reverse);
+    }
+
+    if (sv.length >= 16 && set.n_chars <= sizeof set.chars) {
+        return sse2Find(data, sv.length, &set, negate, reverse);
+    }
+#endif
+
+    return scalarFind(data, sv.length, &set, negate, reverse);
+}
+
+size_t tstrIndexOfFirst(const TString *str, TStringView candidates) {
+    return tsvIndexOfFirst(tsvNewFromStr(str), candidates);
+}
+
+size_t tsvIndexOfFirst(TStringView sv, TStringView candidates) {
+    return find(sv, candidates, false, false);
+}
+
+size_t tstrIndexOfLast(const TString *str, TStringView candidates) {
+    return tsvIndexOfLast(tsvNewFromStr(str), candidates);
+}
+
+size_t tsvIndexOfLast(TStringView sv, TStringView candidates) {
+    return find(sv, candidates, false, true);
+}
+
+size_t tstrIndexOfFirstNot(const TString *str, TStringView candidates) {
+    return tsvIndexOfFirstNot(tsvNewFromStr(str), candidates);
+}
+
+size_t tsvIndexOfFirstNot(TStringView sv, TStringView candidates) {
+    return find(sv, candidates, true, false);
+}
+
+size_t tstrIndexOfLastNot(const TString *str, TStringView candidates) {
+    return tsvIndexOfLastNot(tsvNewFromStr(str), candidates);
+}
+
+size_t tsvIndexOfLastNot(TStringView sv, TStringView candidates) {
+    return find(sv, candidates, true, true);
+}
+
+// Substring search
+//
+// Needles of up to `FILTER_MAX_NEEDLE` bytes are found by comparing the first and the last byte of the needle
+// against a whole block of positions at once and only verifying the positions where both match.
+// Longer needles, and haystacks where the filter lets through too many false candidates, use Two-Way,
+// which never looks at a byte of the haystack more than twice.
+
+#define FILTER_MAX_NEEDLE 64
+
+// Gives up on the filter once the bytes spent verifying candidates exceed this, `scanned` being the number of positions
+// already ruled out. The bound keeps the total work linear in the length of the haystack.
+#define FILTER_BUDGET(scanned, m) (2 * (scanned) + 64 * (m))
+
+// A string which is read backwards if `reverse` is set, so that the same code finds the last occurrence as well
+typedef struct {
+    const unsigned char *data;
+    size_t length;
+    bool reverse;
+} Sequence;
+
+static inline unsigned char seqAt(Sequence s, size_t i) {
+    return s.reverse ? s.data[s.length - 1 - i] : s.data[i];
+}
+
+// Computes the critical factorisation of `needle`: returns the length of its left half and stores its period in `period`
+static inline size_t criticalFactorisation(Sequence needle, size_t *period) {
+    size_t m = needle.length;
+
+    // Maximal suffix for the regular order of bytes...
+    size_t max_suffix = (size_t)-1;
+    size_t j = 0, k = 1, p = 1;
+    while (j + k < m) {
+        unsigned char a = seqAt(needle, j + k);
+        unsigned char b = seqAt(needle, max_suffix + k);
+
+        if (a < b) {
+            j += k;
+            k = 1;
+            p = j - max_suffix;
+        } else if (a == b) {
+            if (k != p) {
+                ++k;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix = j++;
+            k = p = 1;
+        }
+    }
+
+    *period = p;
+
+    // ...and for the reversed order, the longer of the two wins
+    size_t max_suffix_rev = (size_t)-1;
+    j = 0;
+    k = p = 1;
+    while (j + k < m) {
+        unsigned char a = seqAt(needle, j + k);
+        unsigned char b = seqAt(needle, max_suffix_rev + k);
+
+        if (b < a) {
+            j += k;
+            k = 1;
+            p = j - max_suffix_rev;
+        } else if (a == b) {
+            if (k != p) {
+                ++k;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix_rev = j++;
+            k = p = 1;
+        }
+    }
+
+    if (max_suffix_rev + 1 < max_suffix + 1) {
+        return max_suffix + 1;
+    }
+
+    *period = p;
+    return max_suffix_rev + 1;
+}
+
+// Two-Way string matching (Crochemore & Perrin), returns the position in the (possibly reversed) haystack
+static inline size_t twoWay(Sequence haystack, Sequence needle) {
+    size_t n = haystack.length;
+    size_t m = needle.length;
+
+    size_t period;
+    size_t suffix = criticalFactorisation(needle, &period);
+
+    bool periodic = true;
+    for (size_t i = 0; i < suffix; ++i) {
+        if (seqAt(needle, i) != seqAt(needle, i + period)) {
+            periodic = false;
+            break;
+        }
+    }
+
+    if (periodic) {
+        // The part of the needle known to match after a shift by the period
+        size_t memory = 0;
+        size_t j = 0;
+
+        while (j <= n - m) {
+            size_t i = suffix > memory ? suffix : memory;
+            while (i < m && seqAt(needle, i) == seqAt(haystack, i + j)) {
+                ++i;
+            }
+
+            if (i < m) {
+                j += i - suffix + 1;
+                memory = 0;
+                continue;
+            }
+
+            i = suffix - 1;
+            while (memory < i + 1 && seqAt(needle, i) == seqAt(haystack, i + j)) {
+                --i;
+            }
+
+            if (i + 1 < memory + 1) {
+                return j;
+            }
+
+            j += period;
+            memory = m - period;
+        }
+
+        return NOT_FOUND;
+    }
+
+    period = (suffix > m - suffix ? suffix : m - suffix) + 1;
+
+    size_t j = 0;
+    while (j <= n - m) {
+        size_t i = suffix;
+        while (i < m && seqAt(needle, i) == seqAt(haystack, i + j)) {
+            ++i;
+        }
+
+        if (i < m) {
+            j += i - suffix + 1;
+            continue;
+        }
+
+        i = suffix - 1;
+        while (i != (size_t)-1 && seqAt(needle, i) == seqAt(haystack, i + j)) {
+            --i;
+        }
+
+        if (i == (size_t)-1) {
+            return j;
+        }
+
+        j += period;
+    }
+
+    return NOT_FOUND;
+}
+
+static size_t twoWayFirst(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    return twoWay((Sequence) { h, n, false }, (Sequence) { needle, m, false });
+}
+
+static size_t twoWayLast(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t found = twoWay((Sequence) { h, n, true }, (Sequence) { needle, m, true });
+    return found == NOT_FOUND ? NOT_FOUND : n - m - found;
+}
+
+static inline bool matchesAt(const unsigned char *h, const unsigned char *needle, size_t m) {
+    return h[0] == needle[0] && h[m - 1] == needle[m - 1] && memcmp(h + 1, needle + 1, m - 2) == 0;
+}
+
+// Checks the positions `from` to `to` (exclusive) one by one
+static size_t scalarFilterFirst(const unsigned char *h, size_t from, size_t to, const unsigned char *needle, size_t m) {
+    for (size_t j = from; j < to; ++j) {
+        if (matchesAt(h + j, needle, m)) {
+            return j;
+        }
+    }
+
+    return NOT_FOUND;
+}
+
+static size_t scalarFilterLast(const unsigned char *h, size_t from, size_t to, const unsigned char *needle, size_t m) {
+    for (size_t j = to; j-- > from;) {
+        if (matchesAt(h + j, needle, m)) {
+            return j;
+        }
+    }
+
+    return NOT_FOUND;
+}
+
+#if CTL_SIMD_X86
+// The filter over 16 positions at a time, `n_pos` being the number of positions a match could start at
+static size_t sse2FilterFirst(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t n_pos = n - m + 1;
+
+    __m128i first = _mm_set1_epi8((char)needle[0]);
+    __m128i last = _mm_set1_epi8((char)needle[m - 1]);
+
+    size_t verified = 0;
+    size_t j = 0;
+    for (; j + 16 <= n_pos; j += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(h + j));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(h + j + m - 1));
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first),
+            _mm_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask) {
+            size_t pos = j + simdCtz32(mask);
+            if (memcmp(h + pos + 1, needle + 1, m - 2) == 0) {
+                return pos;
+            }
+
+            mask &= mask - 1;
+            verified += m;
+        }
+
+        if (verified > FILTER_BUDGET(j, m)) {
+            size_t found = twoWayFirst(h + j, n - j, needle, m);
+            return found == NOT_FOUND ? NOT_FOUND : j + found;
+        }
+    }
+
+    return scalarFilterFirst(h, j, n_pos, needle, m);
+}
+
+static size_t sse2FilterLast(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t n_pos = n - m + 1;
+
+    __m128i first = _mm_set1_epi8((char)needle[0]);
+    __m128i last = _mm_set1_epi8((char)needle[m - 1]);
+
+    size_t verified = 0;
+    size_t j = n_pos;
+    while (j >= 16) {
+        j -= 16;
+
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(h + j));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(h + j + m - 1));
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(block_first, first),
+            _mm_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask) {
+            unsigned bit = simdHighBit32(mask);
+            if (memcmp(h + j + bit + 1, needle + 1, m - 2) == 0) {
+                return j + bit;
+            }
+
+            mask &= ~((uint32_t)1 << bit);
+            verified += m;
+        }
+
+        if (verified > FILTER_BUDGET(n_pos - j, m)) {
+            return twoWayLast(h, j + 16 + m - 1, needle, m);
+        }
+    }
+
+    return scalarFilterLast(h, 0, j, needle, m);
+}
+
+CTL_TARGET_AVX2
+static size_t avx2FilterFirst(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t n_pos = n - m + 1;
+
+    __m256i first = _mm256_set1_epi8((char)needle[0]);
+    __m256i last = _mm256_set1_epi8((char)needle[m - 1]);
+
+    size_t verified = 0;
+    size_t j = 0;
+    for (; j + 32 <= n_pos; j += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(h + j));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(h + j + m - 1));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first),
+            _mm256_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask) {
+            size_t pos = j + simdCtz32(mask);
+            if (memcmp(h + pos + 1, needle + 1, m - 2) == 0) {
+                return pos;
+            }
+
+            mask &= mask - 1;
+            verified += m;
+        }
+
+        if (verified > FILTER_BUDGET(j, m)) {
+            size_t found = twoWayFirst(h + j, n - j, needle, m);
+            return found == NOT_FOUND ? NOT_FOUND : j + found;
+        }
+    }
+
+    return scalarFilterFirst(h, j, n_pos, needle, m);
+}
+
+CTL_TARGET_AVX2
+static size_t avx2FilterLast(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t n_pos = n - m + 1;
+
+    __m256i first = _mm256_set1_epi8((char)needle[0]);
+    __m256i last = _mm256_set1_epi8((char)needle[m - 1]);
+
+    size_t verified = 0;
+    size_t j = n_pos;
+    while (j >= 32) {
+        j -= 32;
+
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(h + j));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(h + j + m - 1));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(block_first, first),
+            _mm256_cmpeq_epi8(block_last, last)
+        ));
+
+        while (mask) {
+            unsigned bit = simdHighBit32(mask);
+            if (memcmp(h + j + bit + 1, needle + 1, m - 2) == 0) {
+                return j + bit;
+            }
+
+            mask &= ~((uint32_t)1 << bit);
+            verified += m;
+        }
+
+        if (verified > FILTER_BUDGET(n_pos - j, m)) {
+            return twoWayLast(h, j + 32 + m - 1, needle, m);
+        }
+    }
+
+    return scalarFilterLast(h, 0, j, needle, m);
+}
+#endif
+
+#if !CTL_SIMD_X86
+// Portable version of the filter, memchr finds the candidates for the first byte
+static size_t memchrFilterFirst(const unsigned char *h, size_t n, const unsigned char *needle, size_t m) {
+    size_t n_pos = n - m + 1;
+
+    size_t verified = 0;
+    size_t j = 0;
+    while (j < n_pos) {
+        const unsigned char *found = memchr(h + j, needle[0], n_pos - j);
+        if (!found) {
+            return NOT_FOUND;
+        }
+
+        j = (size_t)(found - h);
+        if (matchesAt(h + j, needle, m)) {
+            return j;
+        }
+
+        verified += m;
+        if (verified > FILTER_BUDGET(j, m)) {
+            size_t rest = twoWayFirst(h + j, n - j, needle, m);
+            return rest == NOT_FOUND ? NOT_FOUND : j + rest;
+        }
+
+        ++j;
+    }
+
+    return NOT_FOUND;
+}
+#endif
+
+static size_t findSubstring(TStringView haystack, TStringView needle) {
+    const unsigned char *h = (const unsigned char *)haystack.data;
+    const unsigned char *nd = (const unsigned char *)needle.data;
+    size_t n = haystack.length;
+    size_t m = needle.length;
+
+    if (m == 0) {
+        return 0;
+    }
+
+    if (m > n) {
+        return NOT_FOUND;
+    }
+
+    if (m == 1) {
+        const unsigned char *found = memchr(h, nd[0], n);
+        return found ? (size_t)(found - h) : NOT_FOUND;
+    }
+
+    if (m > FILTER_MAX_NEEDLE) {
+        return twoWayFirst(h, n, nd, m);
+    }
+
+#if CTL_SIMD_X86
+    if (simdHasAvx2()) {
+        return avx2FilterFirst(h, n, nd, m);
+    }
+
+    return sse2FilterFirst(h, n, nd, m);
+#else
+    return memchrFilterFirst(h, n, nd, m);
+#endif
+}
+
+static size_t findSubstringLast(TStringView haystack, TStringView needle) {
+    const unsigned char *h = (const unsigned char *)haystack.data;
+    const unsigned char *nd = (const unsigned char *)needle.data;
+    size_t n = haystack.length;
+    size_t m = needle.length;
+
+    if (m == 0) {
+        return n;
+    }
+
+    if (m > n) {
+        return NOT_FOUND;
+    }
+
+    if (m == 1) {
+        return tsvIndexOfLast(haystack, needle);
+    }
+
+    if (m > FILTER_MAX_NEEDLE) {
+        return twoWayLast(h, n, nd, m);
+    }
+
+#if CTL_SIMD_X86
+    if (simdHasAvx2()) {
+        return avx2FilterLast(h, n, nd, m);
+    }
+
+    return sse2FilterLast(h, n, nd, m);
+#else
+    // Without a reverse memchr, the plain loop is as good as it gets for short inputs
+    if (n < 256) {
+        return scalarFilterLast(h, 0, n - m + 1, nd, m);
+    }
+
+    return twoWayLast(h, n, nd, m);
+#endif
+}
+
+#if CTL_SIMD_X86
+CTL_TARGET_AVX2
+static size_t avx2CountByte(const unsigned char *data, size_t n, unsigned char c) {
+    __m256i needle = _mm256_set1_epi8((char)c);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), needle);
+        count += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(eq));
+    }
+
+    for (; i < n; ++i) {
+        count += data[i] == c;
+    }
+
+    return count;
+}
+
+static size_t sse2CountByte(const unsigned char *data, size_t n, unsigned char c) {
+    __m128i needle = _mm_set1_epi8((char)c);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), needle);
+        count += (size_t)__builtin_popcount((uint32_t)_mm_movemask_epi8(eq));
+    }
+
+    for (; i < n; ++i) {
+        count += data[i] == c;
+    }
+
+    return count;
+}
+#endif
+
+static size_t countByte(const unsigned char *data, size_t n, unsigned char c) {
+#if CTL_SIMD_X86
+    if (simdHasAvx2()) {
+        return avx2CountByte(data, n, c);
+    }
+
+    return sse2CountByte(data, n, c);
+#else
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        count += data[i] == c;
+    }
+
+    return count;
+#endif
+}
+
+size_t tstrFind(const TString *str, TStringView needle) {
+    return tsvFind(tsvNewFromStr(str), needle);
+}
+
+size_t tsvFind(TStringView sv, TStringView needle) {
+    return findSubstring(sv, needle);
+}
+
+size_t tstrFindLast(const TString *str, TStringView needle) {
+    return tsvFindLast(tsvNewFromStr(str), needle);
+}
+
+size_t tsvFindLast(TStringView sv, TStringView needle) {
+    return findSubstringLast(sv, needle);
+}
+
+size_t tstrCount(const TString *str, TStringView needle) {
+    return tsvCount(tsvNewFromStr(str), needle);
+}
+
+size_t tsvCount(TStringView sv, TStringView needle) {
+    if (needle.length == 0) {
+        return 0;
+    }
+
+    if (needle.length == 1) {
+        return countByte((const unsigned char *)sv.data, sv.length, (unsigned char)needle.data[0]);
+    }
+
+    size_t count = 0;
+    size_t start = 0;
+    while (start + needle.length <= sv.length) {
+        size_t found = findSubstring(tsvNewFromBuf((const unsigned char *)sv.data + start, sv.length - start), needle);
+        if (found == NOT_FOUND) {
+            break;
+        }
+
+        ++count;
+        start += found + needle.length;
+    }
+
+    return count;
+}
+
+// Split iterators
+
+#define SPLIT_BLOCK 64
+
+static const char whitespace[] = " \t\n\v\f\r";
+
+#if CTL_SIMD_X86
+static uint64_t sse2ClassifyBlock(const unsigned char *data, const CharSet *set) {
+    uint64_t mask = 0;
+
+    for (size_t part = 0; part < SPLIT_BLOCK / 16; ++part) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + part * 16));
+
+        __m128i eq = _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->chars[0]));
+        for (size_t k = 1; k < set->n_chars; ++k) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, _mm_set1_epi8((char)set->chars[k])));
+        }
+
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(eq) << (part * 16);
+    }
+
+    return mask;
+}
+
+CTL_TARGET_AVX2
+static uint64_t avx2ClassifyBlock(const unsigned char *data, const CharSet *set) {
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)data);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + 32));
+
+    if (set->n_chars == 1) {
+        __m256i c = _mm256_set1_epi8((char)set->chars[0]);
+
+        uint32_t m0 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, c));
+        uint32_t m1 = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, c));
+
+        return (uint64_t)m1 << 32 | m0;
+    }
+
+    __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lo));
+    __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->hi));
+    __m256i bit_table = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128,
+        1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128
+    );
+
+    uint32_t m0 = avx2ClassMask(v0, lo_table, hi_table, bit_table);
+    uint32_t m1 = avx2ClassMask(v1, lo_table, hi_table, bit_table);
+
+    return (uint64_t)m1 << 32 | m0;
+}
+#endif
+
+// Finds the delimiters among the `SPLIT_BLOCK` bytes at `data`, bit `i` of the result is set if `data[i]` is one
+static uint64_t classifyFullBlock(const unsigned char *data, const CharSet *set) {
+#if CTL_SIMD_X86
+    if (simdHasAvx2()) {
+        return avx2ClassifyBlock(data, set);
+    }
+
+    if (set->n_chars <= sizeof set->chars) {
+        return sse2ClassifyBlock(data, set);
+    }
+#endif
+
+    uint64_t mask = 0;
+    for (size_t i = 0; i < SPLIT_BLOCK; ++i) {
+        mask |= (uint64_t)charSetHas(set, data[i]) << i;
+    }
+
+    return mask;
+}
+
+static uint64_t classifyBlock(const TSplitIter *this) {
+    size_t n = this->sv.length - this->block;
+    const unsigned char *data = (const unsigned char *)this->sv.data + this->block;
+
+    if (n >= SPLIT_BLOCK) {
+        return classifyFullBlock(data, &this->delims);
+    }
+
+    // The last block is copied so the vector loads stay inside the input
+    unsigned char padded[SPLIT_BLOCK] = { 0 };
+    memcpy(padded, data, n);
+
+    return classifyFullBlock(padded, &this->delims) & (((uint64_t)1 << n) - 1);
+}
+
+static TSplitIter newSplitIter(TStringView sv, TStringView delims, TSplitKind kind) {
+    TSplitIter this = {
+        .sv = sv,
+        .pos = 0,
+        .block = 0,
+        .mask = 0,
+        .kind = kind,
+        .done = false,
+    };
+
+    charSetInit(&this.delims, delims);
+
+    if (sv.length > 0 && this.delims.n_chars > 0) {
+        this.mask = classifyBlock(&this);
+    }
+
+    return this;
+}
+
+// Returns the position of the next unconsumed delimiter, loading blocks as needed
+static size_t peekDelimiter(TSplitIter *this) {
+    while (this->mask == 0) {
+        if (this->sv.length - this->block <= SPLIT_BLOCK || this->delims.n_chars == 0) {
+            return NOT_FOUND;
+        }
+
+        this->block += SPLIT_BLOCK;
+        this->mask = classifyBlock(this);
+    }
+
+    return this->block + simdCtz64(this->mask);
+}
+
+// Consumes the delimiter returned by `peekDelimiter`
+static void consumeDelimiter(TSplitIter *this) {
+    this->mask &= this->mask - 1;
+}
+
+TSplitIter tsvSplitChar(TStringView sv, char delim) {
+    return newSplitIter(sv, tsvNewFromBuf((const unsigned char *)&delim, 1), TSPLIT_DELIMITERS);
+}
+
+TSplitIter tsvSplitSet(TStringView sv, TStringView delims) {
+    return newSplitIter(sv, delims, TSPLIT_DELIMITERS);
+}
+
+TSplitIter tsvSplitLines(TStringView sv) {
+    return newSplitIter(sv, tsvNewFromL("\n"), TSPLIT_LINES);
+}
+
+TSplitIter tsvSplitWhitespace(TStringView sv) {
+    return newSplitIter(sv, tsvNewFromL(whitespace), TSPLIT_WHITESPACE);
+}
+
+bool tsplitNext(TSplitIter *this, TStringView *out) {
+    if (this->done) {
+        return false;
+    }
+
+    if (this->kind == TSPLIT_WHITESPACE) {
+        // Skip the run of whitespace before the word
+        size_t delim;
+        while ((delim = peekDelimiter(this)) == this->pos) {
+            consumeDelimiter(this);
+            ++this->pos;
+        }
+
+        if (this->pos >= this->sv.length) {
+            this->done = true;
+            return false;
+        }
+    }
+
+    if (this->kind == TSPLIT_LINES && this->pos >= this->sv.length) {
+        this->done = true;
+        return false;
+    }
+
+    size_t end = peekDelimiter(this);
+    if (end == NOT_FOUND) {
+        end = this->sv.length;
+        this->done = true;
+    } else {
+        consumeDelimiter(this);
+    }
+
+    size_t start = this->pos;
+    this->pos = end + 1;
+
+    size_t length = end - start;
+    if (this->kind == TSPLIT_LINES && length > 0 && this->sv.data[end - 1] == '\r' && end < this->sv.length) {
+        --length;
+    }
+
+    *out = tsvNewFromBuf((const unsigned char *)this->sv.data + start, length);
+
+    return true;
+}
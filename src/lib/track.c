@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ctl/alloc.h"
+
+// Keeps the allocations made through the tracker aligned to 16 bytes
+#define HEADER_SIZE 16
+
+static size_t histogramBucket(size_t n_bytes) {
+    size_t bucket = 0;
+    while (n_bytes != 0 && bucket < TALLOC_STATS_BUCKETS - 1) {
+        n_bytes >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+static void count(size_t *counter, size_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void addLive(TAllocStats *stats, size_t n_bytes) {
+    size_t live = __atomic_add_fetch(&stats->live_bytes, n_bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&stats->peak_bytes, __ATOMIC_RELAXED);
+
+    while (live > peak) {
+        if (__atomic_compare_exchange_n(&stats->peak_bytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+static void subLive(TAllocStats *stats, size_t n_bytes) {
+    __atomic_fetch_sub(&stats->live_bytes, n_bytes, __ATOMIC_RELAXED);
+}
+
+static size_t headerSize(const void *ptr) {
+    size_t n_bytes;
+    memcpy(&n_bytes, (const unsigned char *)ptr - HEADER_SIZE, sizeof n_bytes);
+    return n_bytes;
+}
+
+static void *attachHeader(unsigned char *block, size_t n_bytes) {
+    memcpy(block, &n_bytes, sizeof n_bytes);
+    return block + HEADER_SIZE;
+}
+
+TTrackingAllocator ttrackNew(TDynamicAllocator inner) {
+    return (TTrackingAllocator) {
+        .inner = inner,
+        .stats = { 0 },
+    };
+}
+
+static void *trackAllocWrapper(size_t n_bytes, void *tracker) {
+    TTrackingAllocator *this = tracker;
+
+    if (n_bytes > (size_t)-1 - HEADER_SIZE) {
+        return NULL;
+    }
+
+    unsigned char *block = tdaAlloc(&this->inner, HEADER_SIZE + n_bytes);
+    if (!block) {
+        return NULL;
+    }
+
+    count(&this->stats.n_allocs, 1);
+    count(&this->stats.total_bytes, n_bytes);
+    count(this->stats.histogram + histogramBucket(n_bytes), 1);
+    addLive(&this->stats, n_bytes);
+
+    return attachHeader(block, n_bytes);
+}
+
+static void *trackResizeWrapper(void *old, size_t n_bytes, void *tracker) {
+    TTrackingAllocator *this = tracker;
+
+    if (!old) {
+        return trackAllocWrapper(n_bytes, tracker);
+    }
+
+    if (n_bytes > (size_t)-1 - HEADER_SIZE) {
+        return NULL;
+    }
+
+    size_t old_bytes = headerSize(old);
+
+    unsigned char *block = tdaResize(&this->inner, (unsigned char *)old - HEADER_SIZE, HEADER_SIZE + n_bytes);
+    if (!block) {
+        return NULL;
+    }
+
+    count(&this->stats.n_resizes, 1);
+    count(this->stats.histogram + histogramBucket(n_bytes), 1);
+
+    if (n_bytes > old_bytes) {
+        count(&this->stats.n_growths, 1);
+        count(&this->stats.total_bytes, n_bytes - old_bytes);
+        addLive(&this->stats, n_bytes - old_bytes);
+    } else {
+        subLive(&this->stats, old_bytes - n_bytes);
+    }
+
+    return attachHeader(block, n_bytes);
+}
+
+static void trackDeallocWrapper(void *ptr, void *tracker) {
+    TTrackingAllocator *this = tracker;
+
+    if (!ptr) {
+        return;
+    }
+
+    count(&this->stats.n_deallocs, 1);
+    subLive(&this->stats, headerSize(ptr));
+
+    tdaDealloc(&this->inner, (unsigned char *)ptr - HEADER_SIZE);
+}
+
+static size_t trackSizeWrapper(const void *ptr, void *tracker) {
+    (void)tracker;
+    return headerSize(ptr);
+}
+
+TDynamicAllocator tdaTracking(TTrackingAllocator *tracker) {
+    return (TDynamicAllocator) {
+        .alloc = trackAllocWrapper,
+        .resize = trackResizeWrapper,
+        .dealloc = trackDeallocWrapper,
+        .cleanup = NULL,
+        .userdata = tracker,
+        .size = trackSizeWrapper,
+    };
+}
+
+static size_t load(const size_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+TAllocStats ttrackSnapshot(const TTrackingAllocator *this) {
+    TAllocStats stats = {
+        .n_allocs = load(&this->stats.n_allocs),
+        .n_deallocs = load(&this->stats.n_deallocs),
+        .n_resizes = load(&this->stats.n_resizes),
+        .n_growths = load(&this->stats.n_growths),
+        .total_bytes = load(&this->stats.total_bytes),
+        .live_bytes = load(&this->stats.live_bytes),
+        .peak_bytes = load(&this->stats.peak_bytes),
+    };
+
+    for (size_t i = 0; i < TALLOC_STATS_BUCKETS; ++i) {
+        stats.histogram[i] = load(this->stats.histogram + i);
+    }
+
+    return stats;
+}
+
+void ttrackResetStats(TTrackingAllocator *this) {
+    size_t *counters[] = {
+        &this->stats.n_allocs,
+        &this->stats.n_deallocs,
+        &this->stats.n_resizes,
+        &this->stats.n_growths,
+        &this->stats.total_bytes,
+    };
+
+    for (size_t i = 0; i < sizeof counters / sizeof *counters; ++i) {
+        __atomic_store_n(counters[i], 0, __ATOMIC_RELAXED);
+    }
+
+    for (size_t i = 0; i < TALLOC_STATS_BUCKETS; ++i) {
+        __atomic_store_n(this->stats.histogram + i, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&this->stats.peak_bytes, load(&this->stats.live_bytes), __ATOMIC_RELAXED);
+}
+
+void ttrackFree(TTrackingAllocator *this) {
+    tdaFree(&this->inner);
+    *this = (TTrackingAllocator) { 0 };
+}
+
+void tstatsPrint(const TAllocStats *stats, FILE *file) {
+    fprintf(file, "allocations:   %zu\n", stats->n_allocs);
+    fprintf(file, "deallocations: %zu\n", stats->n_deallocs);
+    fprintf(file, "resizes:       %zu (%zu growths)\n", stats->n_resizes, stats->n_growths);
+    fprintf(file, "total bytes:   %zu\n", stats->total_bytes);
+    fprintf(file, "live bytes:    %zu\n", stats->live_bytes);
+    fprintf(file, "peak bytes:    %zu\n", stats->peak_bytes);
+    fprintf(file, "size histogram:\n");
+
+    for (size_t i = 0; i < TALLOC_STATS_BUCKETS; ++i) {
+        if (stats->histogram[i] == 0) {
+            continue;
+        }
+
+        if (i == 0) {
+            fprintf(file, "  %20s  %zu\n", "0", stats->histogram[i]);
+        } else if (i == TALLOC_STATS_BUCKETS - 1) {
+            fprintf(file, "  >= %17zu  %zu\n", (size_t)1 << (i - 1), stats->histogram[i]);
+        } else {
+            fprintf(file, "  < %18zu  %zu\n", (size_t)1 << i, stats->histogram[i]);
+        }
+    }
+}
@@ -0,0 +1,338 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ctl/str.h"
+#include "simd.h"
+
+#define ASCII_MASK ((uint64_t)0x8080808080808080)
+
+static bool isContinuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+static uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// Validates one codepoint starting at `data[*i]`, which is not ASCII
+static bool scalarSequence(const unsigned char *data, size_t n, size_t *i) {
+    unsigned char lead = data[*i];
+    size_t len;
+    unsigned char min = 0x80, max = 0xBF; // Bounds of the first continuation byte
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        len = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        len = 3;
+        if (lead == 0xE0) {
+            min = 0xA0; // Overlong
+        } else if (lead == 0xED) {
+            max = 0x9F; // Surrogates
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        len = 4;
+        if (lead == 0xF0) {
+            min = 0x90; // Overlong
+        } else if (lead == 0xF4) {
+            max = 0x8F; // Above U+10FFFF
+        }
+    } else {
+        return false;
+    }
+
+    if (n - *i < len || data[*i + 1] < min || data[*i + 1] > max) {
+        return false;
+    }
+
+    for (size_t k = 2; k < len; ++k) {
+        if (!isContinuation(data[*i + k])) {
+            return false;
+        }
+    }
+
+    *i += len;
+    return true;
+}
+
+static bool scalarIsUtf8(const unsigned char *data, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        // Skip ASCII 8 bytes at a time
+        if (n - i >= 8 && (load64(data + i) & ASCII_MASK) == 0) {
+            i += 8;
+            continue;
+        }
+
+        if (data[i] < 0x80) {
+            ++i;
+            continue;
+        }
+
+        if (!scalarSequence(data, n, &i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static size_t scalarUtf8Length(const unsigned char *data, size_t n) {
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v = load64(data + i);
+
+        // The top bit of every byte is set unless the byte looks like `10xxxxxx`
+        uint64_t starts = (~v | (v << 1)) & ASCII_MASK;
+        count += simdPopcount64(starts);
+    }
+
+    for (; i < n; ++i) {
+        count += !isContinuation(data[i]);
+    }
+
+    return count;
+}
+
+#if CTL_SIMD_X86
+// Error bits of the lookup tables, see "Validating UTF-8 In Less Than One Instruction Per Byte" (Keiser & Lemire)
+#define TOO_SHORT (1 << 0)  // A lead byte or ASCII followed by a lead byte or ASCII, where a continuation was expected
+#define TOO_LONG (1 << 1)   // ASCII followed by a continuation byte
+#define OVERLONG_3 (1 << 2) // 11100000 100xxxxx
+#define TOO_LARGE (1 << 3)  // 11110100 1001xxxx, 11110100 101xxxxx, 11110101 and above
+#define SURROGATE (1 << 4)  // 11101101 101xxxxx
+#define OVERLONG_2 (1 << 5) // 1100000x 10xxxxxx
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6) // 11110000 1000xxxx
+// Cast so that the tables built with `_mm256_setr_epi8`, which takes `char`s, do not overflow
+#define TWO_CONTS ((char)(1 << 7)) // Two continuation bytes in a row, only valid after a 3 or 4 byte lead
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+// `prev` bytes before each byte of `input`, taking the missing ones from `prev_input`
+#define AVX2_PREV(input, prev_input, n) \
+    _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev_input), (input), 0x21), 16 - (n))
+
+CTL_TARGET_AVX2
+static __m256i avx2SpecialCases(__m256i input, __m256i prev1) {
+    const __m256i byte_1_high_table = _mm256_setr_epi8(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+    );
+
+    const __m256i byte_1_low_table = _mm256_setr_epi8(
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000
+    );
+
+    const __m256i byte_2_high_table = _mm256_setr_epi8(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    );
+
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+    __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+
+    return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+}
+
+// Returns the error bits of a 32 byte block, `prev_input` being the block before it
+CTL_TARGET_AVX2
+static __m256i avx2CheckBlock(__m256i input, __m256i prev_input) {
+    __m256i prev1 = AVX2_PREV(input, prev_input, 1);
+    __m256i special_cases = avx2SpecialCases(input, prev1);
+
+    // Two continuation bytes in a row are fine where a 3 or 4 byte sequence needs them
+    __m256i prev2 = AVX2_PREV(input, prev_input, 2);
+    __m256i prev3 = AVX2_PREV(input, prev_input, 3);
+
+    __m256i is_third_byte = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i is_fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8((char)0x80));
+
+    return _mm256_xor_si256(must_be_continuation, special_cases);
+}
+
+// Non-zero where the block ends in the middle of a sequence
+CTL_TARGET_AVX2
+static __m256i avx2Incomplete(__m256i input) {
+    const __m256i max_value = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1)
+    );
+
+    return _mm256_subs_epu8(input, max_value);
+}
+
+CTL_TARGET_AVX2
+static bool avx2IsUtf8(const unsigned char *data, size_t n) {
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(data + i));
+
+        if (_mm256_movemask_epi8(input) == 0) {
+            // ASCII is valid on its own, as long as the previous block did not end in the middle of a sequence
+            error = _mm256_or_si256(error, prev_incomplete);
+        } else {
+            error = _mm256_or_si256(error, avx2CheckBlock(input, prev_input));
+            prev_incomplete = avx2Incomplete(input);
+        }
+
+        prev_input = input;
+
+        // Bail out early every 1 KiB
+        if ((i & 1023) == 1023 - 31 && !_mm256_testz_si256(error, error)) {
+            return false;
+        }
+    }
+
+    if (i < n) {
+        // Zero padding is ASCII, so an unfinished sequence at the end is caught as too short
+        unsigned char tail[32] = { 0 };
+        memcpy(tail, data + i, n - i);
+
+        __m256i input = _mm256_loadu_si256((const __m256i *)tail);
+        error = _mm256_or_si256(error, avx2CheckBlock(input, prev_input));
+        prev_incomplete = avx2Incomplete(input);
+    }
+
+    error = _mm256_or_si256(error, prev_incomplete);
+
+    return _mm256_testz_si256(error, error);
+}
+
+CTL_TARGET_AVX2
+static size_t avx2Utf8Length(const unsigned char *data, size_t n) {
+    // Continuation bytes are the only ones below -64 as signed chars
+    const __m256i threshold = _mm256_set1_epi8(-65);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t starts = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(input, threshold));
+        count += simdPopcount64(starts);
+    }
+
+    return count + scalarUtf8Length(data + i, n - i);
+}
+#endif
+
+bool tstrIsUtf8(const TString *str) {
+    return tsvIsUtf8(tsvNewFromStr(str));
+}
+
+bool tsvIsUtf8(TStringView sv) {
+    const unsigned char *data = (const unsigned char *)sv.data;
+
+#if CTL_SIMD_X86
+    if (sv.length >= 32 && simdHasAvx2()) {
+        return avx2IsUtf8(data, sv.length);
+    }
+#endif
+
+    return scalarIsUtf8(data, sv.length);
+}
+
+size_t tstrUtf8Length(const TString *str) {
+    return tsvUtf8Length(tsvNewFromStr(str));
+}
+
+size_t tsvUtf8Length(TStringView sv) {
+    const unsigned char *data = (const unsigned char *)sv.data;
+
+#if CTL_SIMD_X86
+    if (sv.length >= 32 && simdHasAvx2()) {
+        return avx2Utf8Length(data, sv.length);
+    }
+#endif
+
+    return scalarUtf8Length(data, sv.length);
+}
+
+// Largest length not above `max` which does not end in the middle of a codepoint
+static size_t boundaryBefore(TStringView sv, size_t max) {
+    if (sv.length <= max) {
+        return sv.length;
+    }
+
+    // A codepoint has at most 3 continuation bytes, don't look further back on invalid input
+    size_t end = max;
+    for (size_t k = 0; k < 3 && end > 0 && isContinuation((unsigned char)sv.data[end]); ++k) {
+        --end;
+    }
+
+    return isContinuation((unsigned char)sv.data[end]) ? max : end;
+}
+
+void tstrTruncUtf8(TString *this, size_t new_len_max) {
+    tstrTrunc(this, boundaryBefore(tsvNewFromStr(this), new_len_max));
+}
+
+TStringView tsvTruncUtf8(TStringView sv, size_t new_len_max) {
+    return tsvNewFromBuf((const unsigned char *)sv.data, boundaryBefore(sv, new_len_max));
+}